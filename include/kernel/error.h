@@ -26,6 +26,7 @@ typedef enum {
 	KERROR_OUT_OF_SPACE = -20,
 	KERROR_FILE_EXISTS = -21,
 	KERROR_NOT_EMPTY = -22,
+	KERROR_BUSY = -23,
 } kernel_error_t;
 
 #endif
@@ -0,0 +1,55 @@
+/*
+Copyright (C) 2016-2019 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file LICENSE for details.
+*/
+
+#ifndef KERNEL_IO_RING_H
+#define KERNEL_IO_RING_H
+
+#include "kernel/types.h"
+
+/*
+An io_ring is a pair of queues in the memory of a process.
+The process posts requests at sq_tail, and the kernel takes them from
+sq_head when the ring is entered.  Each request yields a completion,
+posted by the kernel at cq_tail and consumed by the process from cq_head.
+The indices run freely and are taken modulo IO_RING_SIZE.
+*/
+
+#define IO_RING_SIZE 32
+
+typedef enum {
+	IO_OP_NOP = 0,
+	IO_OP_READ,
+	IO_OP_WRITE,
+	IO_OP_FSYNC,
+	IO_OP_FDATASYNC,
+	IO_OP_TRANSFER
+} io_op_t;
+
+struct io_request {
+	uint32_t opcode;	// one of io_op_t
+	int fd;
+	int fd2;		// destination of IO_OP_TRANSFER
+	void *data;
+	int length;
+	int offset;		// for READ and WRITE, -1 uses and advances the object offset
+	uint32_t user_data;	// returned unchanged in the completion
+};
+
+struct io_completion {
+	uint32_t user_data;
+	int result;		// as returned by the equivalent syscall
+};
+
+struct io_ring {
+	uint32_t sq_head;
+	uint32_t sq_tail;
+	uint32_t cq_head;
+	uint32_t cq_tail;
+	struct io_request sq[IO_RING_SIZE];
+	struct io_completion cq[IO_RING_SIZE];
+};
+
+#endif
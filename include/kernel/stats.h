@@ -21,6 +21,15 @@ struct bcache_stats {
 	int write_hits;
 	int write_misses;
 	int writebacks;
+	int readaheads;
+};
+
+struct fs_extent_stats {
+	uint32_t blocks;		// data blocks held by the file
+	uint32_t extents;		// runs of consecutive blocks in the file
+	uint32_t free_blocks;		// free data blocks in the volume
+	uint32_t free_extents;		// runs of free blocks in the volume
+	uint32_t largest_free_extent;	// blocks in the longest free run
 };
 
 struct process_stats {
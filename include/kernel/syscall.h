@@ -55,6 +55,19 @@ typedef enum {
 	SYSCALL_SYSTEM_RTC,
 	SYSCALL_DEVICE_DRIVER_STATS,
 	SYSCALL_CHDIR,
+	SYSCALL_OBJECT_READDIR,
+	SYSCALL_OBJECT_FSYNC,
+	SYSCALL_OBJECT_FDATASYNC,
+	SYSCALL_OBJECT_EXTENTS,
+	SYSCALL_OBJECT_DEFRAG,
+	SYSCALL_OBJECT_TRANSFER,
+	SYSCALL_OBJECT_PREAD,
+	SYSCALL_OBJECT_PWRITE,
+	SYSCALL_OBJECT_READV,
+	SYSCALL_OBJECT_WRITEV,
+	SYSCALL_IO_RING_ENTER,
+	SYSCALL_OBJECT_MMAP,
+	SYSCALL_PROCESS_MUNMAP,
 	MAX_SYSCALL		// must be the last element in the enum
 } syscall_t;
 
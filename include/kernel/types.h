@@ -54,6 +54,31 @@ typedef enum {
 	KOBJECT_CONSOLE
 } kobject_type_t;
 
+/*
+Directory entries returned by readdir are packed back to back.
+Each occupies length bytes, and the name is null terminated.
+*/
+
+struct dir_entry {
+	uint32_t inumber;
+	uint32_t size;
+	uint16_t type;		// KOBJECT_FILE or KOBJECT_DIR
+	uint16_t length;
+	char name[];
+};
+
+/*
+readv and writev take an array of iovecs, each one buffer in the
+caller, and treat them as a single contiguous stretch of data.
+*/
+
+#define KERNEL_IOV_MAX 64
+
+struct iovec {
+	void *base;
+	int length;
+};
+
 typedef enum {
 	KERNEL_FLAGS_READ=0,
 	KERNEL_FLAGS_WRITE=1,
@@ -62,5 +87,16 @@ typedef enum {
 	KERNEL_FLAGS_DIRECT=8
 } kernel_flags_t;
 
+typedef enum {
+	KERNEL_MMAP_PRIVATE=0,	// read-only
+	KERNEL_MMAP_SHARED=1	// writable, and written back to the file
+} kernel_mmap_t;
+
+typedef enum {
+	KERNEL_SEEK_SET=0,
+	KERNEL_SEEK_CUR=1,
+	KERNEL_SEEK_END=2
+} kernel_seek_t;
+
 
 #endif
@@ -9,6 +9,7 @@ See the file LICENSE for details.
 
 #include "kernel/types.h"
 #include "kernel/stats.h"
+#include "kernel/io_ring.h"
 
 void syscall_debug(const char *str);
 
@@ -45,17 +46,43 @@ int syscall_object_dup(int fd1, int fd2);
 int syscall_object_read(int fd, void *data, int length);
 int syscall_object_read_nonblock(int fd, void *data, int length);
 int syscall_object_list( int fd, char *buffer, int buffer_len);
+int syscall_object_readdir( int fd, struct dir_entry *buffer, int buffer_len, uint32_t *cookie );
 int syscall_object_write(int fd, void *data, int length);
+int syscall_object_readv(int fd, struct iovec *iov, int count);
+int syscall_object_writev(int fd, struct iovec *iov, int count);
 int syscall_object_seek(int fd, int offset, int whence);
+int syscall_object_pread(int fd, void *data, int length, int offset);
+int syscall_object_pwrite(int fd, void *data, int length, int offset);
 int syscall_object_size(int fd, int * dims, int n);
 int syscall_object_copy( int src, int dst );
+int syscall_object_transfer(int src, int dst, int length);
 int syscall_object_remove( int fd, const char *name );
 int syscall_object_close(int fd);
+int syscall_object_fsync(int fd);
+int syscall_object_fdatasync(int fd);
+int syscall_object_extents(int fd, struct fs_extent_stats *s);
+int syscall_object_defrag(int fd);
 int syscall_object_set_tag(int fd, char *tag);
 int syscall_object_get_tag(int fd, char *buffer, int buffer_size);
 int syscall_object_set_blocking(int fd, int b);
 int syscall_object_max();
 
+/*
+Map length bytes of a file, from a page aligned offset, into this
+process, either KERNEL_MMAP_PRIVATE (read-only) or KERNEL_MMAP_SHARED.
+The address of the mapping is returned in addr.
+*/
+
+int syscall_object_mmap(int fd, int offset, int length, int flags, void **addr);
+int syscall_process_munmap(void *addr);
+
+/*
+Carry out requests posted on an io_ring: at least to_submit of them,
+and more until min_complete completions are waiting.
+*/
+
+int syscall_io_ring_enter(struct io_ring *ring, int to_submit, int min_complete);
+
 /* Syscalls that query or affect the whole system state. */
 
 int syscall_system_stats(struct system_stats *s);
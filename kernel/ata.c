@@ -244,7 +244,7 @@ int ata_read(int id, void *buffer, int nblocks, int offset)
 	return result;
 }
 
-static int atapi_begin(int id, void *data, int length)
+static int atapi_begin(int id, void *data, int length, int limit)
 {
 	int base = ata_base[id];
 	int flags;
@@ -271,8 +271,9 @@ static int atapi_begin(int id, void *data, int length)
 	outb(0, base + ATAPI_FEATURE);
 	outb(0, base + ATAPI_IRR);
 	outb(0, base + ATAPI_SAMTAG);
-	outb(length & 0xff, base + ATAPI_COUNT_LO);
-	outb(length >> 8, base + ATAPI_COUNT_HI);
+	// the byte count is the most data the device may send per DRQ
+	outb(limit & 0xff, base + ATAPI_COUNT_LO);
+	outb(limit >> 8, base + ATAPI_COUNT_HI);
 
 	// execute the command
 	outb(ATAPI_COMMAND_PACKET, base + ATA_COMMAND);
@@ -306,7 +307,7 @@ static int atapi_read_unlocked(int id, void *buffer, int nblocks, int offset)
 	packet[10] = 0;
 	packet[11] = 0;
 
-	if(!atapi_begin(id, packet, length))
+	if(!atapi_begin(id, packet, length, ATAPI_BLOCKSIZE))
 		return 0;
 
 	// XXX On fast virtual hardware, waiting for the interrupt
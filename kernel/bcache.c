@@ -8,6 +8,7 @@ See the file LICENSE for details.
 #include "list.h"
 #include "page.h"
 #include "kmalloc.h"
+#include "slab.h"
 #include "string.h"
 #include "kernel/error.h"
 
@@ -23,16 +24,21 @@ static struct list cache = LIST_INIT;
 static struct bcache_stats stats = {0};
 static int max_cache_size = 100;
 
+#define BCACHE_RUN_BYTES 32768
+
+static struct slab_cache entry_cache = SLAB_CACHE_INIT("bcache_entry", sizeof(struct bcache_entry), 0);
+
 struct bcache_entry * bcache_entry_create( struct device *device, int block )
 {
-	struct bcache_entry *e = kmalloc(sizeof(*e));
+	struct bcache_entry *e = slab_alloc(&entry_cache);
 	if(!e) return 0;
 
 	e->device = device;
 	e->block = block;
+	e->dirty = 0;
 	e->data = page_alloc(1);
 	if(!e->data) {
-		kfree(e);
+		slab_free(&entry_cache, e);
 		return 0;
 	}
 
@@ -44,19 +50,80 @@ void bcache_entry_delete( struct bcache_entry *e )
 {
 	if(e) {
 		if(e->data) page_free(e->data);
-		kfree(e);
+		slab_free(&entry_cache, e);
+	}
+}
+
+struct bcache_entry * bcache_find( struct device *device, int block )
+{
+	struct list_node *n;
+	struct bcache_entry *e;
+
+	for(n=cache.head;n;n=n->next) {
+		e = (struct bcache_entry *)n;
+		if(e->device==device && e->block==block) {
+			return e;
+		}
 	}
+
+	return 0;
+}
+
+/*
+Dirty blocks are written back in runs: cleaning one entry also
+cleans any dirty neighbours in the cache, up to BCACHE_RUN_BYTES,
+so that a file written in order reaches the device in a few large
+writes rather than one command per block.
+*/
+
+static struct bcache_entry * bcache_find_dirty( struct device *device, int block )
+{
+	struct bcache_entry *e = bcache_find(device,block);
+	if(e && e->dirty) return e;
+	return 0;
 }
 
 void bcache_entry_clean( struct bcache_entry *e )
 {
-	if(e->dirty) {
+	if(!e->dirty) return;
+
+	int bs = device_block_size(e->device);
+	int max = BCACHE_RUN_BYTES / bs;
+	int first = e->block;
+	int last = e->block;
+	int i;
+
+	while(last-first+1<max && first>0 && bcache_find_dirty(e->device,first-1)) first--;
+	while(last-first+1<max && bcache_find_dirty(e->device,last+1)) last++;
+
+	int count = last-first+1;
+	char *buffer = 0;
+	if(count>1) buffer = kmalloc(count*bs);
+
+	if(!buffer) {
 		device_write(e->device,e->data,1,e->block);
 		// XXX How to deal with failure here?
 		e->dirty = 0;
 		stats.writebacks++;
+		return;
 	}
 
+	// e may already be off the list, if it is being evicted.
+	for(i=0;i<count;i++) {
+		struct bcache_entry *r = first+i==e->block ? e : bcache_find(e->device,first+i);
+		memcpy(&buffer[i*bs],r->data,bs);
+	}
+
+	device_write(e->device,buffer,count,first);
+	// XXX How to deal with failure here?
+
+	for(i=0;i<count;i++) {
+		struct bcache_entry *r = first+i==e->block ? e : bcache_find(e->device,first+i);
+		r->dirty = 0;
+	}
+
+	stats.writebacks += count;
+	kfree(buffer);
 }
 
 void bcache_trim()
@@ -70,21 +137,6 @@ void bcache_trim()
 	}
 }
 
-struct bcache_entry * bcache_find( struct device *device, int block )
-{
-	struct list_node *n;
-	struct bcache_entry *e;
-
-	for(n=cache.head;n;n=n->next) {
-		e = (struct bcache_entry *)n;
-		if(e->device==device && e->block==block) {
-			return e;
-		}
-	}
-
-	return 0;
-}
-
 struct bcache_entry * bcache_find_or_create( struct device *device, int block, int *was_a_hit )
 {
 	struct bcache_entry *e = bcache_find(device,block);
@@ -148,6 +200,52 @@ int bcache_read( struct device *device, char *data, int blocks, int offset )
 }
 
 
+/*
+Read ahead up to count blocks, starting at block, with a single
+device read.  The run stops at the first block already in the cache,
+and a run of one is left to the ordinary read path.  The blocks go
+in at the head of the cache, since the caller is about to use them.
+Returns the number of blocks read.
+*/
+
+int bcache_prefetch( struct device *device, int block, int count )
+{
+	int bs = device_block_size(device);
+	int i;
+
+	count = MIN(count,BCACHE_RUN_BYTES/bs);
+	count = MIN(count,max_cache_size/4);
+
+	for(i=0;i<count;i++) {
+		if(bcache_find(device,block+i)) break;
+	}
+	count = i;
+
+	if(count<2) return 0;
+
+	char *buffer = kmalloc(count*bs);
+	if(!buffer) return 0;
+
+	if(device_read(device,buffer,count,block)<1) {
+		kfree(buffer);
+		return 0;
+	}
+
+	for(i=count-1;i>=0;i--) {
+		struct bcache_entry *e = bcache_entry_create(device,block+i);
+		if(!e) break;
+		memcpy(e->data,&buffer[i*bs],bs);
+		list_push_head(&cache,&e->node);
+	}
+
+	kfree(buffer);
+
+	stats.readaheads += count-1-i;
+	bcache_trim();
+
+	return count-1-i;
+}
+
 int bcache_write_block( struct device *device, const char *data, int block )
 {
 	int hit;
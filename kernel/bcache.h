@@ -16,6 +16,8 @@ int  bcache_write( struct device *d, const char *data, int blocks, int offset );
 int  bcache_read_block( struct device *d, char *data, int block );
 int  bcache_write_block( struct device *d, const char *data, int block );
 
+int  bcache_prefetch( struct device *d, int block, int count );
+
 void bcache_flush_block( struct device *d, int block );
 void bcache_flush_device( struct device *d  );
 void bcache_flush_all();
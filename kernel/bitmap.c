@@ -7,6 +7,7 @@ See the file LICENSE for details.
 #include "bitmap.h"
 #include "kernelcore.h"
 #include "kmalloc.h"
+#include "vmalloc.h"
 
 static struct bitmap root_bitmap;
 
@@ -25,7 +26,7 @@ struct bitmap *bitmap_create(int width, int height, int format)
 	if(!b)
 		return 0;
 
-	b->data = kmalloc(width * height * 3);
+	b->data = vmalloc(width * height * 3);
 	if(!b->data) {
 		kfree(b);
 		return 0;
@@ -40,6 +41,6 @@ struct bitmap *bitmap_create(int width, int height, int format)
 
 void bitmap_delete(struct bitmap *b)
 {
-	kfree(b->data);
+	vfree(b->data);
 	kfree(b);
 }
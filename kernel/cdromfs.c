@@ -18,20 +18,34 @@ See the file LICENSE for details.
 
 static struct fs_dirent *cdrom_dirent_create(struct fs_volume *volume, int sector, int length, int isdir)
 {
-	struct fs_dirent *d = kmalloc(sizeof(*d));
+	struct fs_dirent *d = fs_dirent_alloc();
 	if(!d) return 0;
 
 	d->volume = volume;
 	d->refcount = 1;
 	d->size = length;
 	d->isdir = isdir;
+	d->inumber = sector;
 	d->cdrom.sector = sector;
 
 	return d;
 }
 
+/*
+Files and directories are contiguous on the disc, so a read that
+misses the cache brings in the following blocks of the same item
+with it, up to CDROMFS_READAHEAD blocks, in one device command.
+*/
+
+#define CDROMFS_READAHEAD 16
+
 static int cdrom_dirent_read_block(struct fs_dirent *d, char *buffer, uint32_t blocknum)
 {
+	uint32_t total = (d->size + CDROMFS_BLOCK_SIZE - 1) / CDROMFS_BLOCK_SIZE;
+	if(blocknum + 1 < total) {
+		bcache_prefetch(d->volume->device, d->cdrom.sector + blocknum, MIN(total - blocknum, CDROMFS_READAHEAD));
+	}
+
 	int nblocks = bcache_read(d->volume->device, buffer, 1, d->cdrom.sector + blocknum);
 	if(nblocks == 1) {
 		return CDROMFS_BLOCK_SIZE;
@@ -167,6 +181,66 @@ static int cdrom_dirent_list(struct fs_dirent *dir, char *buffer, int buffer_len
 	return total;
 }
 
+/*
+The readdir cookie is the byte offset of the next record in the
+directory.  Records never cross a sector, and the unused end
+of each sector is marked by a zero descriptor length.
+*/
+
+static int cdrom_dirent_readdir(struct fs_dirent *dir, char *buffer, int buffer_length, uint32_t *cookie)
+{
+	char *temp = page_alloc(0);
+	if(!temp) return KERROR_OUT_OF_MEMORY;
+
+	uint32_t offset = *cookie;
+	int loaded = -1;
+	int total = 0;
+	char name[256];
+
+	while(offset < dir->size) {
+		int sector = offset / CDROMFS_BLOCK_SIZE;
+		if(sector != loaded) {
+			if(cdrom_dirent_read_block(dir,temp,sector)<0) {
+				if(!total) total = KERROR_NOT_FOUND;
+				break;
+			}
+			loaded = sector;
+		}
+
+		struct iso_9660_directory_entry *d = (struct iso_9660_directory_entry *) &temp[offset % CDROMFS_BLOCK_SIZE];
+
+		if(d->descriptor_length == 0) {
+			offset = (sector + 1) * CDROMFS_BLOCK_SIZE;
+			continue;
+		}
+
+		if(d->ident[0] == 0) {
+			strcpy(name, ".");
+		} else if(d->ident[0] == 1) {
+			strcpy(name, "..");
+		} else {
+			// Copy the name, since fix_filename writes past the end.
+			memcpy(name, d->ident, d->ident_length);
+			fix_filename(name, d->ident_length);
+		}
+
+		int used = fs_readdir_pack(buffer+total, buffer_length-total, name, strlen(name),
+			d->flags & ISO_9660_EXTENT_FLAG_DIRECTORY, d->first_sector_little, d->length_little);
+		if(!used) {
+			if(!total) total = KERROR_INVALID_REQUEST;
+			break;
+		}
+		total += used;
+
+		offset += d->descriptor_length;
+	}
+
+	*cookie = offset;
+	page_free(temp);
+
+	return total;
+}
+
 static struct fs_volume *cdrom_volume_create( struct device *device )
 {
 	struct fs_volume *v = kmalloc(sizeof(*v));
@@ -187,6 +261,8 @@ static int cdrom_volume_close(struct fs_volume *v)
 
 static struct fs_volume *cdrom_volume_open( struct device *device )
 {
+	if(!device) return 0;
+
 	struct fs_volume *v = cdrom_volume_create(device);
 
 	struct iso_9660_volume_descriptor *d = page_alloc(0);
@@ -250,6 +326,7 @@ const static struct fs_ops cdrom_ops = {
 	.read_block = cdrom_dirent_read_block,
 	.write_block = 0,
 	.list = cdrom_dirent_list,
+	.readdir = cdrom_dirent_readdir,
 	.remove = 0,
 	.resize = 0,
 	.close = cdrom_dirent_close,
@@ -88,7 +88,10 @@ int device_set_multiplier( struct device *d, int multiplier )
 void device_close( struct device *d )
 {
 	d->refcount--;
-	if(d->refcount<1) kfree(d);
+	if(d->refcount<1) {
+		if(d->driver->release) d->driver->release(d->unit);
+		kfree(d);
+	}
 }
 
 int device_read(struct device *d, void *data, int size, int offset)
@@ -124,7 +127,7 @@ int device_write(struct device *d, const void *data, int size, int offset)
 	int status;
 	if(d->driver->write) {
 		status = d->driver->write(d->unit,data,size*d->multiplier,offset*d->multiplier);
-		if (!status) {
+		if (status > 0) {
 			d->driver->stats.blocks_written += size*d->multiplier;
 		}
 		return status;
@@ -13,6 +13,7 @@ See the file LICENSE for details.
 #include "fs_internal.h"
 #include "bcache.h"
 #include "page.h"
+#include "clock.h"
 
 /* Read or write a block from the raw device, starting from zero. */
 
@@ -26,46 +27,486 @@ static int diskfs_block_write(struct device *d, struct diskfs_block *b, uint32_t
 	return bcache_write(d, b->data, 1, blockno) ? DISKFS_BLOCK_SIZE : -1;
 }
 
+/*
+The journal gathers the metadata blocks changed by many operations
+into one running transaction held in memory.  Reads of those blocks
+are answered from the transaction, so nothing reaches its home
+location before it is safely in the log.  The transaction is written
+to the log as one sequential run of blocks when it fills up, when it
+has been open for too long, or when a file is synced.  An idle
+system checks the age of each open transaction, so the last one
+before a pause is committed on time, and not left in memory.  After that,
+the blocks are handed to the buffer cache, to be written home lazily.
+When the log runs out of room, a checkpoint flushes the buffer cache
+and moves the start of the log forward.
+
+File data is not journaled, but the data blocks written since the
+last commit are flushed before the commit, so that metadata never
+points to data that has not reached the disk.  One exception: a block
+logged as metadata since the last checkpoint, then freed and reused
+for data, keeps going through the journal, so a replay cannot bring
+back its old contents.
+*/
+
+/* The most blocks that a single operation adds to a transaction. */
+#define DISKFS_JOURNAL_OP_BLOCKS 8
+
+/* Commit a transaction once it has been open this long. */
+#define DISKFS_JOURNAL_COMMIT_MILLIS 1000
+
+/* Data blocks remembered for flushing at the next commit. */
+#define DISKFS_JOURNAL_ORDERED_BLOCKS 64
+
+struct diskfs_journal {
+	struct device *device;
+	uint32_t header;	// block number of the journal header
+	uint32_t length;	// blocks in the log, just after the header
+	uint32_t head;		// log position of the next transaction
+	uint32_t used;		// log blocks written since the last checkpoint
+	uint32_t sequence;	// sequence number of the next transaction
+	uint32_t first_target;	// home blocks must fall within these bounds
+	uint32_t last_target;
+
+	uint32_t count;		// blocks in the running transaction
+	uint32_t targets[DISKFS_JOURNAL_TXN_BLOCKS];
+	struct diskfs_block *blocks[DISKFS_JOURNAL_TXN_BLOCKS];
+	clock_t opened;
+
+	uint32_t *logged;	// home blocks logged since the last checkpoint
+	uint32_t nlogged;
+
+	uint32_t ordered[DISKFS_JOURNAL_ORDERED_BLOCKS];	// data blocks written since the last commit
+	uint32_t nordered;
+
+	uint32_t commits;
+	uint32_t blocks_logged;
+	uint32_t checkpoints;
+
+	struct diskfs_journal *next;
+};
+
+static struct diskfs_journal *journal_list = 0;
+
+static int diskfs_journal_log_read( struct diskfs_journal *j, struct diskfs_block *b, uint32_t position )
+{
+	return device_read(j->device,b->data,1,j->header+1+position%j->length);
+}
+
+static int diskfs_journal_log_write( struct diskfs_journal *j, struct diskfs_block *b, uint32_t position )
+{
+	return device_write(j->device,b->data,1,j->header+1+position%j->length);
+}
+
+static int diskfs_journal_find( struct diskfs_journal *j, uint32_t blockno )
+{
+	int i;
+	for(i=0;i<j->count;i++) {
+		if(j->targets[i]==blockno) return i;
+	}
+	return -1;
+}
+
+/* Return true if blockno is in the running transaction or logged since the last checkpoint. */
+
+static int diskfs_journal_logged( struct diskfs_journal *j, uint32_t blockno )
+{
+	int i;
+	if(diskfs_journal_find(j,blockno)>=0) return 1;
+	for(i=0;i<j->nlogged;i++) {
+		if(j->logged[i]==blockno) return 1;
+	}
+	return 0;
+}
+
+static int diskfs_journal_read( struct diskfs_journal *j, struct diskfs_block *b, uint32_t blockno )
+{
+	int i = diskfs_journal_find(j,blockno);
+	if(i<0) return 0;
+	memcpy(b->data,j->blocks[i]->data,DISKFS_BLOCK_SIZE);
+	return 1;
+}
+
+static void diskfs_journal_flush_ordered( struct diskfs_journal *j )
+{
+	int i;
+	for(i=0;i<j->nordered;i++) {
+		bcache_flush_block(j->device,j->ordered[i]);
+	}
+	j->nordered = 0;
+}
+
+/* Remember a data block to be flushed before the next commit. */
+
+static void diskfs_journal_order( struct diskfs_journal *j, uint32_t blockno )
+{
+	int i;
+	for(i=0;i<j->nordered;i++) {
+		if(j->ordered[i]==blockno) return;
+	}
+	if(j->nordered==DISKFS_JOURNAL_ORDERED_BLOCKS) diskfs_journal_flush_ordered(j);
+	j->ordered[j->nordered++] = blockno;
+}
+
+static int diskfs_journal_write_header( struct diskfs_journal *j )
+{
+	struct diskfs_block *b = page_alloc(1);
+	if(!b) return KERROR_OUT_OF_MEMORY;
+
+	b->journal.magic = DISKFS_JOURNAL_MAGIC;
+	b->journal.sequence = j->sequence;
+	b->journal.start = j->head;
+
+	int result = device_write(j->device,b->data,1,j->header);
+	page_free(b);
+	return result;
+}
+
+/*
+Write every committed block to its home location,
+after which the whole log is free to be reused.
+*/
+
+static void diskfs_journal_checkpoint( struct diskfs_journal *j )
+{
+	bcache_flush_device(j->device);
+	diskfs_journal_write_header(j);
+	j->used = 0;
+	j->nlogged = 0;
+	j->checkpoints++;
+}
+
+/*
+Write the running transaction to the log as a descriptor block,
+the blocks themselves, and a commit block, all at consecutive
+positions.  The commit block goes last, so that a transaction
+cut short by a crash is ignored at replay.
+*/
+
+static int diskfs_journal_commit( struct diskfs_journal *j )
+{
+	int i, k;
+	int result = 0;
+
+	diskfs_journal_flush_ordered(j);
+
+	if(j->count==0) return 0;
+
+	uint32_t needed = j->count + 2;
+	if(j->used+needed>j->length) diskfs_journal_checkpoint(j);
+
+	struct diskfs_block *r = page_alloc(1);
+	if(!r) return KERROR_OUT_OF_MEMORY;
+
+	r->record.magic = DISKFS_JOURNAL_MAGIC;
+	r->record.type = DISKFS_JOURNAL_DESCRIPTOR;
+	r->record.sequence = j->sequence;
+	r->record.count = j->count;
+	memcpy(r->record.targets,j->targets,j->count*sizeof(uint32_t));
+
+	if(diskfs_journal_log_write(j,r,j->head)<1) result = -1;
+	for(i=0;i<j->count && result==0;i++) {
+		if(diskfs_journal_log_write(j,j->blocks[i],j->head+1+i)<1) result = -1;
+	}
+	r->record.type = DISKFS_JOURNAL_COMMIT;
+	if(result==0 && diskfs_journal_log_write(j,r,j->head+1+j->count)<1) result = -1;
+
+	page_free(r);
+
+	if(result<0) printf("diskfs: warning: couldn't write journal, updating in place\n");
+
+	// Committed or not, the blocks must still reach their home locations.
+	for(i=0;i<j->count;i++) {
+		if(bcache_write_block(j->device,j->blocks[i]->data,j->targets[i])<1) {
+			device_write(j->device,j->blocks[i]->data,1,j->targets[i]);
+		}
+		for(k=0;k<j->nlogged;k++) {
+			if(j->logged[k]==j->targets[i]) break;
+		}
+		if(k==j->nlogged) j->logged[j->nlogged++] = j->targets[i];
+	}
+
+	j->head = (j->head+needed)%j->length;
+	j->used += needed;
+	j->sequence++;
+	j->commits++;
+	j->blocks_logged += j->count;
+	j->count = 0;
+
+	return result;
+}
+
+static int diskfs_journal_write( struct diskfs_journal *j, struct diskfs_block *b, uint32_t blockno )
+{
+	int i = diskfs_journal_find(j,blockno);
+
+	if(i<0) {
+		if(j->count==DISKFS_JOURNAL_TXN_BLOCKS) diskfs_journal_commit(j);
+		i = j->count;
+		if(!j->blocks[i]) {
+			j->blocks[i] = page_alloc(0);
+			if(!j->blocks[i]) return KERROR_OUT_OF_MEMORY;
+		}
+		if(j->count==0) j->opened = clock_read();
+		j->targets[i] = blockno;
+		j->count++;
+	}
+
+	memcpy(j->blocks[i]->data,b->data,DISKFS_BLOCK_SIZE);
+	return DISKFS_BLOCK_SIZE;
+}
+
+static int diskfs_journal_expired( struct diskfs_journal *j )
+{
+	clock_t elapsed = clock_diff(j->opened,clock_read());
+	return j->count>0 && elapsed.seconds*1000 + elapsed.millis>=DISKFS_JOURNAL_COMMIT_MILLIS;
+}
+
+/*
+Called as each operation completes, so that a transaction
+always holds whole operations.  Commit if another operation
+might not fit, or if the transaction has been open too long.
+*/
+
+static void diskfs_journal_end_op( struct diskfs_journal *j )
+{
+	if(j->count==0) return;
+
+	if(j->count+DISKFS_JOURNAL_OP_BLOCKS>DISKFS_JOURNAL_TXN_BLOCKS || diskfs_journal_expired(j)) {
+		diskfs_journal_commit(j);
+	}
+}
+
+/*
+The idle loop only runs between operations, never in the middle
+of one, so it may commit whatever transaction has grown too old.
+*/
+
+int diskfs_journal_commit_expired()
+{
+	struct diskfs_journal *j;
+	int work = 0;
+
+	for(j=journal_list;j;j=j->next) {
+		if(diskfs_journal_expired(j)) {
+			diskfs_journal_commit(j);
+			work = 1;
+		}
+	}
+
+	return work;
+}
+
+void diskfs_journal_commit_all()
+{
+	struct diskfs_journal *j;
+
+	for(j=journal_list;j;j=j->next) {
+		diskfs_journal_commit(j);
+	}
+}
+
+/* Check that r is the record of the given type and sequence that replay expects. */
+
+static int diskfs_journal_record_valid( struct diskfs_journal *j, struct diskfs_journal_record *r, uint32_t type, uint32_t sequence )
+{
+	int i;
+
+	if(r->magic!=DISKFS_JOURNAL_MAGIC || r->type!=type || r->sequence!=sequence) return 0;
+	if(r->count==0 || r->count>DISKFS_JOURNAL_TXN_BLOCKS || r->count+2>j->length) return 0;
+
+	for(i=0;i<r->count;i++) {
+		if(r->targets[i]<j->first_target || r->targets[i]>=j->last_target) return 0;
+	}
+
+	return 1;
+}
+
+/*
+Starting from the header, copy each complete transaction
+in the log to its home location, stopping at the first one
+that is missing, stale, or lacks its commit block.
+*/
+
+static int diskfs_journal_replay( struct diskfs_journal *j )
+{
+	struct diskfs_block *r = page_alloc(0);
+	struct diskfs_block *c = page_alloc(0);
+	struct diskfs_block *b = page_alloc(0);
+	int i, n = 0;
+
+	if(!r || !c || !b) {
+		if(r) page_free(r);
+		if(c) page_free(c);
+		if(b) page_free(b);
+		return KERROR_OUT_OF_MEMORY;
+	}
+
+	while(n<j->length) {
+		if(diskfs_journal_log_read(j,r,j->head)<1) break;
+		if(!diskfs_journal_record_valid(j,&r->record,DISKFS_JOURNAL_DESCRIPTOR,j->sequence)) break;
+
+		uint32_t count = r->record.count;
+
+		if(diskfs_journal_log_read(j,c,j->head+1+count)<1) break;
+		if(!diskfs_journal_record_valid(j,&c->record,DISKFS_JOURNAL_COMMIT,j->sequence)) break;
+		if(c->record.count!=count || memcmp(c->record.targets,r->record.targets,count*sizeof(uint32_t))) break;
+
+		for(i=0;i<count;i++) {
+			if(diskfs_journal_log_read(j,b,j->head+1+i)<1) break;
+			bcache_write_block(j->device,b->data,r->record.targets[i]);
+		}
+		if(i<count) break;
+
+		j->head = (j->head+count+2)%j->length;
+		j->sequence++;
+		n++;
+	}
+
+	page_free(r);
+	page_free(c);
+	page_free(b);
+
+	return n;
+}
+
+static struct diskfs_journal * diskfs_journal_open( struct device *device, struct diskfs_superblock *sb )
+{
+	if(sb->journal_blocks==0) return 0;
+
+	if(sb->journal_blocks<DISKFS_JOURNAL_TXN_BLOCKS+3) {
+		printf("diskfs: journal too small, updating in place\n");
+		return 0;
+	}
+
+	struct diskfs_journal *j = kmalloc(sizeof(*j));
+	if(!j) return 0;
+
+	memset(j,0,sizeof(*j));
+	j->device = device;
+	j->header = sb->journal_start;
+	j->length = sb->journal_blocks-1;
+	j->first_target = sb->inode_start;
+	j->last_target = sb->data_start + sb->data_blocks;
+
+	j->logged = kmalloc(j->length*sizeof(uint32_t));
+	struct diskfs_block *b = page_alloc(0);
+
+	if(!j->logged || !b || device_read(device,b->data,1,j->header)<1 || b->journal.magic!=DISKFS_JOURNAL_MAGIC) {
+		printf("diskfs: couldn't load journal, updating in place\n");
+		if(b) page_free(b);
+		if(j->logged) kfree(j->logged);
+		kfree(j);
+		return 0;
+	}
+
+	j->head = b->journal.start % j->length;
+	j->sequence = b->journal.sequence;
+	page_free(b);
+
+	int n = diskfs_journal_replay(j);
+	if(n>0) {
+		printf("diskfs: replayed %d transactions from journal\n",n);
+		diskfs_journal_checkpoint(j);
+	}
+
+	j->next = journal_list;
+	journal_list = j;
+
+	return j;
+}
+
+static void diskfs_journal_close( struct diskfs_journal *j )
+{
+	struct diskfs_journal **p;
+	int i;
+
+	for(p=&journal_list;*p;p=&(*p)->next) {
+		if(*p==j) {
+			*p = j->next;
+			break;
+		}
+	}
+
+	diskfs_journal_commit(j);
+	diskfs_journal_checkpoint(j);
+
+	printf("diskfs: journal: %d transactions, %d blocks logged, %d checkpoints\n",j->commits,j->blocks_logged,j->checkpoints);
+
+	for(i=0;i<DISKFS_JOURNAL_TXN_BLOCKS;i++) {
+		if(j->blocks[i]) page_free(j->blocks[i]);
+	}
+	kfree(j->logged);
+	kfree(j);
+}
+
+/*
+Read or write a block of the volume, through the journal if the
+volume has one.  Metadata is always journaled, file data only
+if the block was logged as metadata since the last checkpoint.
+*/
+
+static int diskfs_volume_block_read(struct fs_volume *v, struct diskfs_block *b, uint32_t blockno )
+{
+	if(v->disk.journal && diskfs_journal_read(v->disk.journal,b,blockno)) return DISKFS_BLOCK_SIZE;
+	return diskfs_block_read(v->device,b,blockno);
+}
+
+static int diskfs_volume_block_write(struct fs_volume *v, struct diskfs_block *b, uint32_t blockno, int metadata )
+{
+	struct diskfs_journal *j = v->disk.journal;
+	if(j && (metadata || diskfs_journal_logged(j,blockno))) return diskfs_journal_write(j,b,blockno);
+	if(j) diskfs_journal_order(j,blockno);
+	return diskfs_block_write(v->device,b,blockno);
+}
+
+static void diskfs_volume_end_op( struct fs_volume *v )
+{
+	if(v->disk.journal) diskfs_journal_end_op(v->disk.journal);
+}
+
 /* Read or write a bitmap block, starting from the bitmap offset. */
 
 static int diskfs_bitmap_block_read(struct fs_volume *v, struct diskfs_block *b, uint32_t blockno )
 {
-	if(blockno>=v->disk.bitmap_blocks) return KERROR_OUT_OF_SPACE;
-	return diskfs_block_read(v->device,b,v->disk.bitmap_start+blockno);
+	if(blockno>=v->disk.super.bitmap_blocks) return KERROR_OUT_OF_SPACE;
+	return diskfs_volume_block_read(v,b,v->disk.super.bitmap_start+blockno);
 }
 
 static int diskfs_bitmap_block_write(struct fs_volume *v, struct diskfs_block *b, uint32_t blockno )
 {
-	if(blockno>=v->disk.bitmap_blocks) return KERROR_OUT_OF_SPACE;
-	return diskfs_block_write(v->device,b,v->disk.bitmap_start+blockno);
+	if(blockno>=v->disk.super.bitmap_blocks) return KERROR_OUT_OF_SPACE;
+	return diskfs_volume_block_write(v,b,v->disk.super.bitmap_start+blockno,1);
 }
 
 /* Read or write an inode block, starting from the inode block offset. */
 
 static int diskfs_inode_block_read(struct fs_volume *v, struct diskfs_block *b, uint32_t blockno )
 {
-	if(blockno>=v->disk.inode_blocks) return KERROR_OUT_OF_SPACE;
-	return diskfs_block_read(v->device,b,v->disk.inode_start+blockno);
+	if(blockno>=v->disk.super.inode_blocks) return KERROR_OUT_OF_SPACE;
+	return diskfs_volume_block_read(v,b,v->disk.super.inode_start+blockno);
 }
 
 static int diskfs_inode_block_write(struct fs_volume *v, struct diskfs_block *b, uint32_t blockno )
 {
-	if(blockno>=v->disk.inode_blocks) return KERROR_OUT_OF_SPACE;
-	return diskfs_block_write(v->device,b,v->disk.inode_start+blockno);
+	if(blockno>=v->disk.super.inode_blocks) return KERROR_OUT_OF_SPACE;
+	return diskfs_volume_block_write(v,b,v->disk.super.inode_start+blockno,1);
 }
 
-/* Read or write a data block, starting from the data block offset. */
+/*
+Read or write a data block, starting from the data block offset.
+Directory and indirect blocks are written as metadata.
+*/
 
 static int diskfs_data_block_read(struct fs_volume *v, struct diskfs_block *b, uint32_t blockno )
 {
-	if(blockno>=v->disk.data_blocks) return KERROR_OUT_OF_SPACE;
-	return diskfs_block_read(v->device,b,v->disk.data_start+blockno);
+	if(blockno>=v->disk.super.data_blocks) return KERROR_OUT_OF_SPACE;
+	return diskfs_volume_block_read(v,b,v->disk.super.data_start+blockno);
 }
 
-static int diskfs_data_block_write(struct fs_volume *v, struct diskfs_block *b, uint32_t blockno )
+static int diskfs_data_block_write(struct fs_volume *v, struct diskfs_block *b, uint32_t blockno, int metadata )
 {
-	if(blockno>=v->disk.data_blocks) return KERROR_OUT_OF_SPACE;
-	return diskfs_block_write(v->device,b,v->disk.data_start+blockno);
+	if(blockno>=v->disk.super.data_blocks) return KERROR_OUT_OF_SPACE;
+	return diskfs_volume_block_write(v,b,v->disk.super.data_start+blockno,metadata);
 }
 
 /*
@@ -77,22 +518,22 @@ If nothing available, return zero.
 static uint32_t diskfs_data_block_alloc( struct fs_volume *v )
 {
 	struct diskfs_block *b = page_alloc(0);
-	struct diskfs_superblock *s= &v->disk;
+	struct diskfs_superblock *s= &v->disk.super;
 	int i, j, k;
 
 	for(i=0;i<s->bitmap_blocks;i++) {
 		diskfs_bitmap_block_read(v,b,i);
 		for(j=0;j<DISKFS_BLOCK_SIZE;j++) {
-			if(b->data[j]!=0xff) {
+			if((uint8_t)b->data[j]!=0xff) {
 				for(k=0;k<8;k++) {
 					if(!((1<<k) & b->data[j])) {
-						int blockno = i*DISKFS_BLOCK_SIZE+j*8+k;
+						int blockno = i*DISKFS_BLOCK_SIZE*8+j*8+k;
 
 						// Never allocate block zero;
 						if(blockno==0) continue;
 
 						// Do not exceet the actual number of blocks
-						if(blockno>=v->disk.data_blocks) break;
+						if(blockno>=v->disk.super.data_blocks) break;
 
 						b->data[j] |= 1<<k;
 						diskfs_bitmap_block_write(v,b,i);
@@ -110,32 +551,85 @@ static uint32_t diskfs_data_block_alloc( struct fs_volume *v )
 	return 0;
 }
 
-static void diskfs_data_block_free( struct fs_volume *v, int blockno )
+/* Set or clear the bitmap bit of one data block. */
+
+static void diskfs_data_block_mark( struct fs_volume *v, int blockno, int used )
 {
 	struct diskfs_block *b = page_alloc(0);
 
-	int bitmap_block = blockno/DISKFS_BLOCK_SIZE;
-	int bitmap_byte = blockno%DISKFS_BLOCK_SIZE/8;
-	int bitmap_bit = blockno%DISKFS_BLOCK_SIZE%8;
+	int bitmap_block = blockno/(DISKFS_BLOCK_SIZE*8);
+	int bitmap_byte = blockno%(DISKFS_BLOCK_SIZE*8)/8;
+	int bitmap_bit = blockno%8;
 
 	diskfs_bitmap_block_read(v,b,bitmap_block);
-	b->data[bitmap_byte] &= ~(1<<bitmap_bit);
+	if(used) {
+		b->data[bitmap_byte] |= 1<<bitmap_bit;
+	} else {
+		b->data[bitmap_byte] &= ~(1<<bitmap_bit);
+	}
 	diskfs_bitmap_block_write(v,b,bitmap_block);
 
 	page_free(b);
 }
 
+static void diskfs_data_block_free( struct fs_volume *v, int blockno )
+{
+	diskfs_data_block_mark(v,blockno,0);
+}
+
+/*
+Return true if a data block is in use according to the bitmap.
+b caches the bitmap block last read, whose number is in *loaded,
+so that a scan in block order reads each bitmap block only once.
+*/
+
+static int diskfs_bitmap_test( struct fs_volume *v, struct diskfs_block *b, int *loaded, uint32_t blockno )
+{
+	int bitmap_block = blockno/(DISKFS_BLOCK_SIZE*8);
+	int bit = blockno%(DISKFS_BLOCK_SIZE*8);
+
+	if(bitmap_block!=*loaded) {
+		diskfs_bitmap_block_read(v,b,bitmap_block);
+		*loaded = bitmap_block;
+	}
+
+	return (b->data[bit/8]>>(bit%8))&1;
+}
+
+/* Find the first run of free data blocks of the given length, or return zero. */
+
+static uint32_t diskfs_free_run_find( struct fs_volume *v, uint32_t length )
+{
+	struct diskfs_block *b = page_alloc(0);
+	uint32_t blockno, run = 0;
+	int loaded = -1;
+
+	if(!b) return 0;
+
+	for(blockno=1;blockno<v->disk.super.data_blocks;blockno++) {
+		if(diskfs_bitmap_test(v,b,&loaded,blockno)) {
+			run = 0;
+		} else if(++run==length) {
+			page_free(b);
+			return blockno-length+1;
+		}
+	}
+
+	page_free(b);
+	return 0;
+}
+
 static int diskfs_inumber_alloc( struct fs_volume *v )
 {
 	struct diskfs_block *b = page_alloc(0);
 	int i, j;
 
-	for(i=0;i<v->disk.inode_blocks;i++) {
+	for(i=0;i<v->disk.super.inode_blocks;i++) {
 		diskfs_inode_block_read(v,b,i);
 		for(j=0;j<DISKFS_INODES_PER_BLOCK;j++) {
-			if(!b->inodes[j].inuse) {
+			if(!b->inodes[j].flags) {
 				int inumber = i * DISKFS_INODES_PER_BLOCK + j;
-				b->inodes[j].inuse = 1;
+				b->inodes[j].flags = DISKFS_INODE_INUSE;
 				diskfs_inode_block_write(v,b,i);
 				page_free(b);
 				return inumber;
@@ -154,7 +648,7 @@ static void diskfs_inumber_free( struct fs_volume *v, int inumber )
 	int inode_block = inumber / DISKFS_INODES_PER_BLOCK;
 	struct diskfs_block *b = page_alloc(0);
 	diskfs_inode_block_read(v,b,inode_block);
-	b->inodes[inumber%DISKFS_INODES_PER_BLOCK].inuse = 0;
+	b->inodes[inumber%DISKFS_INODES_PER_BLOCK].flags = 0;
 	diskfs_inode_block_write(v,b,inode_block);
 	page_free(b);
 }
@@ -230,7 +724,7 @@ int diskfs_inode_write( struct fs_dirent *d, struct diskfs_block *b, uint32_t bl
 			i->indirect = actual;
 			diskfs_inode_save(d->volume,d->inumber,i);	
 			memset(iblock,0,DISKFS_BLOCK_SIZE);
-			diskfs_data_block_write(d->volume,iblock,i->indirect);
+			diskfs_data_block_write(d->volume,iblock,i->indirect,1);
 		}
 
 		diskfs_data_block_read(d->volume,iblock,i->indirect);
@@ -242,18 +736,78 @@ int diskfs_inode_write( struct fs_dirent *d, struct diskfs_block *b, uint32_t bl
 				return KERROR_OUT_OF_SPACE;
 			}
 			iblock->pointers[block-DISKFS_DIRECT_POINTERS] = actual;
-			diskfs_data_block_write(d->volume,iblock,i->indirect);
+			diskfs_data_block_write(d->volume,iblock,i->indirect,1);
 		}
 		page_free(iblock);
 	}
 
-	return diskfs_data_block_write(d->volume,b,actual);
+	return diskfs_data_block_write(d->volume,b,actual,d->isdir);
+}
+
+/*
+Each dirent works on its own copy of the inode, so an operation that
+moves the blocks of a file can only be done safely through the one
+dirent that has it open.  This list counts the open dirents of each inode.
+*/
+
+struct diskfs_open {
+	struct fs_volume *volume;
+	int inumber;
+	int count;
+	struct diskfs_open *next;
+};
+
+static struct diskfs_open *open_list = 0;
+
+static struct diskfs_open * diskfs_open_find( struct fs_volume *volume, int inumber )
+{
+	struct diskfs_open *o;
+	for(o=open_list;o;o=o->next) {
+		if(o->volume==volume && o->inumber==inumber) return o;
+	}
+	return 0;
+}
+
+static void diskfs_open_release( struct fs_volume *volume, int inumber )
+{
+	struct diskfs_open **p;
+	for(p=&open_list;*p;p=&(*p)->next) {
+		struct diskfs_open *o = *p;
+		if(o->volume==volume && o->inumber==inumber) {
+			o->count--;
+			if(o->count<1) {
+				*p = o->next;
+				kfree(o);
+			}
+			return;
+		}
+	}
 }
 
 struct fs_dirent * diskfs_dirent_create( struct fs_volume *volume, int inumber, int type )
 {
-	struct fs_dirent *d = kmalloc(sizeof(*d));
-	memset(d,0,sizeof(*d));
+	struct diskfs_open *o = diskfs_open_find(volume,inumber);
+	struct diskfs_open *n = 0;
+	if(!o) {
+		n = kmalloc(sizeof(*n));
+		if(!n) return 0;
+	}
+
+	struct fs_dirent *d = fs_dirent_alloc();
+	if(!d) {
+		if(n) kfree(n);
+		return 0;
+	}
+
+	if(n) {
+		n->volume = volume;
+		n->inumber = inumber;
+		n->count = 0;
+		n->next = open_list;
+		open_list = n;
+		o = n;
+	}
+	o->count++;
 
 	diskfs_inode_load(volume,inumber,&d->disk);
 
@@ -268,14 +822,21 @@ struct fs_dirent * diskfs_dirent_create( struct fs_volume *volume, int inumber,
 
 int diskfs_dirent_close( struct fs_dirent *d )
 {
-	// XXX check if inode dirty first
-	diskfs_inode_save(d->volume,d->inumber,&d->disk);
+	// Only save the inode if it changed, to keep it out of the journal.
+	struct diskfs_inode saved;
+	diskfs_inode_load(d->volume,d->inumber,&saved);
+	if(memcmp(&saved,&d->disk,sizeof(saved))) {
+		diskfs_inode_save(d->volume,d->inumber,&d->disk);
+		diskfs_volume_end_op(d->volume);
+	}
+	diskfs_open_release(d->volume,d->inumber);
 	return 0;
 }
 
 struct fs_dirent * diskfs_dirent_lookup( struct fs_dirent *d, const char *name )
 {
 	struct diskfs_block *b = page_alloc(0);
+	int name_length = strlen(name);
 	int i, j;
 
 	int nblocks = d->size / DISKFS_BLOCK_SIZE;
@@ -285,7 +846,7 @@ struct fs_dirent * diskfs_dirent_lookup( struct fs_dirent *d, const char *name )
 		diskfs_inode_read(d,b,i);
 		for(j=0;j<DISKFS_ITEMS_PER_BLOCK;j++) {
 			struct diskfs_item *r = &b->items[j];
-			if(r->type!=DISKFS_ITEM_BLANK && !strncmp(name,r->name,r->name_length)) {
+			if(r->type!=DISKFS_ITEM_BLANK && r->name_length==name_length && !strncmp(name,r->name,name_length)) {
 				int inumber = r->inumber;
 				page_free(b);
 				return diskfs_dirent_create(d->volume,inumber,r->type);
@@ -333,8 +894,97 @@ int diskfs_dirent_list( struct fs_dirent *d, char *buffer, int length )
 	return total;
 }
 
+/*
+The readdir cookie is the index of the next item slot,
+counting across all of the blocks of the directory.
+*/
+
+int diskfs_dirent_readdir( struct fs_dirent *d, char *buffer, int length, uint32_t *cookie )
+{
+	struct diskfs_block *b = page_alloc(0);
+	if(!b) return KERROR_OUT_OF_MEMORY;
+	struct diskfs_inode inode;
+
+	int nblocks = d->size / DISKFS_BLOCK_SIZE;
+	if(d->size%DISKFS_BLOCK_SIZE) nblocks++;
+
+	uint32_t n = *cookie;
+	uint32_t nitems = nblocks * DISKFS_ITEMS_PER_BLOCK;
+	int loaded = -1;
+	int total = 0;
+
+	while(n<nitems) {
+		if(n/DISKFS_ITEMS_PER_BLOCK!=loaded) {
+			loaded = n/DISKFS_ITEMS_PER_BLOCK;
+			diskfs_inode_read(d,b,loaded);
+		}
+
+		struct diskfs_item *r = &b->items[n%DISKFS_ITEMS_PER_BLOCK];
+		if(r->type!=DISKFS_ITEM_BLANK) {
+			diskfs_inode_load(d->volume,r->inumber,&inode);
+			int used = fs_readdir_pack(buffer+total,length-total,r->name,r->name_length,r->type==DISKFS_ITEM_DIR,r->inumber,inode.size);
+			if(!used) {
+				if(!total) total = KERROR_INVALID_REQUEST;
+				break;
+			}
+			total += used;
+		}
+		n++;
+	}
+
+	*cookie = n;
+	page_free(b);
+
+	return total;
+}
+
+/*
+Move the contents of an inline file into a data block, so that
+it can grow beyond DISKFS_INLINE_SIZE.  This frees the pointers,
+which were holding the data.  The block is written before the
+inode changes, so that on failure the file keeps its inline data.
+*/
+
+static int diskfs_inline_migrate( struct fs_dirent *d )
+{
+	struct diskfs_inode *i = &d->disk;
+	uint32_t blockno = 0;
+
+	struct diskfs_block *b = page_alloc(1);
+	if(!b) return KERROR_OUT_OF_MEMORY;
+
+	if(i->size>0) {
+		blockno = diskfs_data_block_alloc(d->volume);
+		if(!blockno) {
+			page_free(b);
+			return KERROR_OUT_OF_SPACE;
+		}
+		memcpy(b->data,i->data,MIN(i->size,DISKFS_INLINE_SIZE));
+		int result = diskfs_data_block_write(d->volume,b,blockno,d->isdir);
+		if(result<0) {
+			diskfs_data_block_free(d->volume,blockno);
+			page_free(b);
+			return result;
+		}
+	}
+
+	memset(i->data,0,DISKFS_INLINE_SIZE);
+	i->flags &= ~DISKFS_INODE_INLINE;
+	i->direct[0] = blockno;
+	diskfs_inode_save(d->volume,d->inumber,i);
+
+	page_free(b);
+	return 0;
+}
+
 int diskfs_dirent_resize( struct fs_dirent *d, uint32_t size )
 {
+	if((d->disk.flags&DISKFS_INODE_INLINE) && size>DISKFS_INLINE_SIZE) {
+		int result = diskfs_inline_migrate(d);
+		if(result<0) return result;
+	} else if((d->disk.flags&DISKFS_INODE_INLINE) && size<d->disk.size) {
+		memset(&d->disk.data[size],0,DISKFS_INLINE_SIZE-size);
+	}
 	d->size = d->disk.size = size;
 	return 0;
 }
@@ -372,7 +1022,8 @@ static int diskfs_dirent_add( struct fs_dirent *d, const char *name, int type, i
 	r->name_length = strlen(name);
 	memcpy(r->name,name,r->name_length);
 
-	diskfs_dirent_resize(d,d->size+sizeof(*r));
+	// The size must reach into the new block, even if earlier items were reused.
+	diskfs_dirent_resize(d,i*DISKFS_BLOCK_SIZE+sizeof(*r));
 	diskfs_inode_write(d,b,i);
 	diskfs_inode_save(d->volume,d->inumber,&d->disk);
 
@@ -393,10 +1044,13 @@ struct fs_dirent * diskfs_dirent_create_file_or_dir( struct fs_dirent *d, const
 
 	struct diskfs_inode inode;
 	memset(&inode,0,sizeof(inode));
-	inode.inuse = 1;
+	// A new file starts out inline, until it grows too large.
+	inode.flags = DISKFS_INODE_INUSE;
+	if(type==DISKFS_ITEM_FILE) inode.flags |= DISKFS_INODE_INLINE;
 	inode.size = 0;
 	diskfs_inode_save(d->volume,inumber,&inode);
 	diskfs_dirent_add(d,name,type,inumber);
+	diskfs_volume_end_op(d->volume);
 	return diskfs_dirent_create(d->volume,inumber,type);
 }
 
@@ -415,26 +1069,27 @@ void diskfs_inode_delete( struct fs_volume *v, struct diskfs_inode *node, int in
 	int size = 0;
 	int i;
 
+	// An inline file has no blocks to free.
+	if(node->flags&DISKFS_INODE_INLINE) size = node->size;
 
 	// XXX check for errors in here
-	for(i=0;i<DISKFS_DIRECT_POINTERS;i++) {
-		diskfs_data_block_free(v,node->direct[i]);
+	for(i=0;i<DISKFS_DIRECT_POINTERS && size<node->size;i++) {
+		if(node->direct[i]) diskfs_data_block_free(v,node->direct[i]);
 		size += v->block_size;
-		if(size>=node->size) break;
 	}
 
-	if(size<node->size) {
+	if(!(node->flags&DISKFS_INODE_INLINE) && node->indirect) {
 		struct diskfs_block *b = page_alloc(0);
 		diskfs_data_block_read(v,b,node->indirect);
-		for(i=0;i<DISKFS_POINTERS_PER_BLOCK;i++) {
-			diskfs_data_block_free(v,b->pointers[i]);
+		for(i=0;i<DISKFS_POINTERS_PER_BLOCK && size<node->size;i++) {
+			if(b->pointers[i]) diskfs_data_block_free(v,b->pointers[i]);
 			size += v->block_size;
-			if(size>=node->size) break;
 		}
 		page_free(b);
+		diskfs_data_block_free(v,node->indirect);
 	}
 
-	memset(node,sizeof(*node),0);
+	memset(node,0,sizeof(*node));
 	diskfs_inode_save(v,inumber,node);
 	diskfs_inumber_free(v,inumber);
 }
@@ -456,35 +1111,322 @@ int diskfs_dirent_remove( struct fs_dirent *d, const char *name )
 
 			if(r->type!=DISKFS_ITEM_BLANK && r->name_length==name_length && !strncmp(name,r->name,name_length)) {
 
-				if(r->type==DISKFS_ITEM_DIR) {
-					struct diskfs_inode inode;
-					diskfs_inode_load(d->volume,r->inumber,&inode);
-					if(inode.size>0) {
-						page_free(b);
-						return KERROR_NOT_EMPTY;
-					}
+				struct diskfs_inode inode;
+				diskfs_inode_load(d->volume,r->inumber,&inode);
+
+				if(r->type==DISKFS_ITEM_DIR && inode.size>0) {
+					page_free(b);
+					return KERROR_NOT_EMPTY;
 				}
 
 				int inumber = r->inumber;
 				r->type = DISKFS_ITEM_BLANK;
 				diskfs_inode_write(d,b,i);
-				diskfs_inode_delete(d->volume,&d->disk,inumber);
+				diskfs_inode_delete(d->volume,&inode,inumber);
+				diskfs_volume_end_op(d->volume);
 				page_free(b);
 				return 0;
 			}
 		}
 	}
 
+	page_free(b);
 	return KERROR_NOT_FOUND;
 }
 
+/*
+Return the data block number holding logical block n of an inode,
+where b holds the indirect block if it is needed.
+*/
+
+static uint32_t diskfs_inode_block_number( struct diskfs_inode *i, struct diskfs_block *b, uint32_t n )
+{
+	if(n<DISKFS_DIRECT_POINTERS) {
+		return i->direct[n];
+	} else if(b && n-DISKFS_DIRECT_POINTERS<DISKFS_POINTERS_PER_BLOCK) {
+		return b->pointers[n-DISKFS_DIRECT_POINTERS];
+	} else {
+		return 0;
+	}
+}
+
+/*
+Write back the cached blocks of one file or directory, in an
+order that keeps the disk consistent if interrupted: first the
+data blocks, then the indirect block that points to them, then
+the bitmap blocks recording their allocation, and the inode last.
+A datasync skips the bitmap, which is not needed to find the data.
+With a journal, the data blocks are written back, and then all
+of the metadata goes to the log in a single commit.
+*/
+
+int diskfs_dirent_sync( struct fs_dirent *d, int datasync )
+{
+	struct fs_volume *v = d->volume;
+	struct diskfs_inode *i = &d->disk;
+	struct diskfs_block *b = 0;
+	uint32_t n, blockno;
+
+	uint32_t nblocks = d->size / DISKFS_BLOCK_SIZE;
+	if(d->size%DISKFS_BLOCK_SIZE) nblocks++;
+
+	// The data of an inline file is in the inode.
+	if(i->flags&DISKFS_INODE_INLINE) nblocks = 0;
+
+	if(nblocks>DISKFS_DIRECT_POINTERS && i->indirect) {
+		b = page_alloc(0);
+		if(!b) return KERROR_OUT_OF_MEMORY;
+		diskfs_data_block_read(v,b,i->indirect);
+	}
+
+	for(n=0;n<nblocks;n++) {
+		blockno = diskfs_inode_block_number(i,b,n);
+		if(blockno) bcache_flush_block(v->device,v->disk.super.data_start+blockno);
+	}
+
+	// The dirent may hold a newer size than the cached inode block.
+	struct diskfs_inode saved;
+	diskfs_inode_load(v,d->inumber,&saved);
+	if(memcmp(&saved,i,sizeof(saved))) diskfs_inode_save(v,d->inumber,i);
+
+	if(v->disk.journal) {
+		if(b) page_free(b);
+		return diskfs_journal_commit(v->disk.journal);
+	}
+
+	if(i->indirect) bcache_flush_block(v->device,v->disk.super.data_start+i->indirect);
+
+	if(!datasync) {
+		for(n=0;n<nblocks;n++) {
+			blockno = diskfs_inode_block_number(i,b,n);
+			if(blockno) bcache_flush_block(v->device,v->disk.super.bitmap_start+blockno/(DISKFS_BLOCK_SIZE*8));
+		}
+		if(i->indirect) bcache_flush_block(v->device,v->disk.super.bitmap_start+i->indirect/(DISKFS_BLOCK_SIZE*8));
+	}
+
+	bcache_flush_block(v->device,v->disk.super.inode_start+d->inumber/DISKFS_INODES_PER_BLOCK);
+
+	if(b) page_free(b);
+	return 0;
+}
+
+/*
+Load the data block numbers of an inode into a new array,
+with zero for any hole, and return the number of entries.
+*/
+
+static int diskfs_inode_block_list( struct fs_dirent *d, uint32_t **list )
+{
+	struct diskfs_inode *i = &d->disk;
+	struct diskfs_block *b = 0;
+	uint32_t n;
+
+	*list = 0;
+
+	if(i->flags&DISKFS_INODE_INLINE) return 0;
+
+	uint32_t nblocks = d->size / DISKFS_BLOCK_SIZE;
+	if(d->size%DISKFS_BLOCK_SIZE) nblocks++;
+	if(nblocks==0) return 0;
+
+	if(nblocks>DISKFS_DIRECT_POINTERS+DISKFS_POINTERS_PER_BLOCK) return KERROR_INVALID_REQUEST;
+
+	*list = kmalloc(nblocks*sizeof(uint32_t));
+	if(!*list) return KERROR_OUT_OF_MEMORY;
+
+	if(nblocks>DISKFS_DIRECT_POINTERS && i->indirect) {
+		b = page_alloc(0);
+		if(!b) {
+			kfree(*list);
+			return KERROR_OUT_OF_MEMORY;
+		}
+		diskfs_data_block_read(d->volume,b,i->indirect);
+	}
+
+	for(n=0;n<nblocks;n++) {
+		(*list)[n] = diskfs_inode_block_number(i,b,n);
+	}
+
+	if(b) page_free(b);
+	return nblocks;
+}
+
+/*
+Report how many data blocks a file holds and in how many runs
+of consecutive blocks, along with the fragmentation of the free
+space in the whole volume.
+*/
+
+int diskfs_dirent_extents( struct fs_dirent *d, struct fs_extent_stats *s )
+{
+	struct fs_volume *v = d->volume;
+	uint32_t *list;
+	uint32_t n, prev = 0, run = 0;
+
+	memset(s,0,sizeof(*s));
+
+	int nblocks = diskfs_inode_block_list(d,&list);
+	if(nblocks<0) return nblocks;
+
+	for(n=0;n<nblocks;n++) {
+		if(!list[n]) continue;
+		if(s->blocks==0 || list[n]!=prev+1) s->extents++;
+		s->blocks++;
+		prev = list[n];
+	}
+	if(list) kfree(list);
+
+	struct diskfs_block *b = page_alloc(0);
+	if(!b) return KERROR_OUT_OF_MEMORY;
+	int loaded = -1;
+
+	for(n=1;n<v->disk.super.data_blocks;n++) {
+		if(diskfs_bitmap_test(v,b,&loaded,n)) {
+			run = 0;
+		} else {
+			if(run==0) s->free_extents++;
+			run++;
+			s->free_blocks++;
+			if(run>s->largest_free_extent) s->largest_free_extent = run;
+		}
+	}
+
+	page_free(b);
+	return 0;
+}
+
+/*
+Move the blocks of a file into one run of free blocks, with the
+indirect block, if any, just ahead of the data.  The copies are
+written and the inode pointed at them before the old blocks are
+freed, so an interruption leaves either the old or the new layout.
+Another open dirent of the file would keep, and later save, the old
+pointers, so the file must not be open anywhere else.
+*/
+
+int diskfs_dirent_defrag( struct fs_dirent *d )
+{
+	struct fs_volume *v = d->volume;
+	struct diskfs_inode *i = &d->disk;
+	uint32_t *list;
+	uint32_t n, count = 0, extents = 0, prev = 0;
+	int result = 0;
+
+	struct diskfs_open *o = diskfs_open_find(v,d->inumber);
+	if(o && o->count>1) return KERROR_BUSY;
+
+	int nblocks = diskfs_inode_block_list(d,&list);
+	if(nblocks<=0) return nblocks;
+
+	int indirect = nblocks>DISKFS_DIRECT_POINTERS;
+
+	for(n=0;n<nblocks;n++) {
+		if(!list[n]) continue;
+		if(count==0 || list[n]!=prev+1) extents++;
+		count++;
+		prev = list[n];
+	}
+
+	// Nothing to gain if the data is already one run, just behind its indirect block.
+	uint32_t first = 0;
+	for(n=0;n<nblocks && !first;n++) first = list[n];
+	if(extents<=1 && (!indirect || i->indirect+1==first)) {
+		kfree(list);
+		return 0;
+	}
+
+	uint32_t start = diskfs_free_run_find(v,count+indirect);
+	if(!start) {
+		kfree(list);
+		return KERROR_OUT_OF_SPACE;
+	}
+
+	struct diskfs_block *b = page_alloc(0);
+	struct diskfs_block *iblock = page_alloc(1);
+	if(!b || !iblock) {
+		if(b) page_free(b);
+		if(iblock) page_free(iblock);
+		kfree(list);
+		return KERROR_OUT_OF_MEMORY;
+	}
+
+	for(n=0;n<count+indirect;n++) {
+		diskfs_data_block_mark(v,start+n,1);
+	}
+
+	uint32_t next = start + indirect;
+	uint32_t old_indirect = i->indirect;
+
+	for(n=0;n<nblocks;n++) {
+		if(!list[n]) continue;
+		if(diskfs_data_block_read(v,b,list[n])<0 || diskfs_data_block_write(v,b,next,d->isdir)<0) {
+			result = KERROR_INVALID_REQUEST;
+			break;
+		}
+		if(n<DISKFS_DIRECT_POINTERS) {
+			i->direct[n] = next;
+		} else {
+			iblock->pointers[n-DISKFS_DIRECT_POINTERS] = next;
+		}
+		next++;
+	}
+
+	if(result<0) {
+		// Put back the old pointers and give up the new run.
+		for(n=0;n<nblocks && n<DISKFS_DIRECT_POINTERS;n++) i->direct[n] = list[n];
+		for(n=0;n<count+indirect;n++) diskfs_data_block_mark(v,start+n,0);
+	} else {
+		if(indirect) {
+			i->indirect = start;
+			diskfs_data_block_write(v,iblock,start,1);
+		}
+		diskfs_inode_save(v,d->inumber,i);
+
+		// The new layout must be on disk before the old blocks can be reused.
+		diskfs_dirent_sync(d,0);
+
+		for(n=0;n<nblocks;n++) {
+			if(list[n]) diskfs_data_block_free(v,list[n]);
+		}
+		if(indirect && old_indirect) diskfs_data_block_free(v,old_indirect);
+	}
+
+	diskfs_volume_end_op(v);
+
+	page_free(b);
+	page_free(iblock);
+	kfree(list);
+	return result;
+}
+
+/*
+The data of an inline file is read and written directly in the
+dirent's copy of the inode, and never needs a block of its own.
+The file has already been migrated by resize if it is too large.
+*/
+
 int diskfs_dirent_write_block( struct fs_dirent *d, const char *data, uint32_t blockno )
 {
-	return diskfs_inode_write(d,(void*)data,blockno);
+	if(d->disk.flags&DISKFS_INODE_INLINE) {
+		if(blockno>0) return KERROR_INVALID_REQUEST;
+		memcpy(d->disk.data,data,DISKFS_INLINE_SIZE);
+		diskfs_inode_save(d->volume,d->inumber,&d->disk);
+		diskfs_volume_end_op(d->volume);
+		return DISKFS_BLOCK_SIZE;
+	}
+
+	int result = diskfs_inode_write(d,(void*)data,blockno);
+	diskfs_volume_end_op(d->volume);
+	return result;
 }
 
 int diskfs_dirent_read_block( struct fs_dirent *d, char *data, uint32_t blockno )
 {
+	if(d->disk.flags&DISKFS_INODE_INLINE) {
+		memset(data,0,DISKFS_BLOCK_SIZE);
+		if(blockno==0) memcpy(data,d->disk.data,MIN(d->disk.size,DISKFS_INLINE_SIZE));
+		return DISKFS_BLOCK_SIZE;
+	}
 	return diskfs_inode_read(d,(void*)data,blockno);
 }
 
@@ -492,6 +1434,8 @@ extern struct fs disk_fs;
 
 struct fs_volume * diskfs_volume_open( struct device *device )
 {
+	if(!device) return 0;
+
 	struct diskfs_block *b = page_alloc(0);
 
 	printf("diskfs: opening device %s unit %d\n",device_name(device),device_unit(device));
@@ -511,14 +1455,17 @@ struct fs_volume * diskfs_volume_open( struct device *device )
 	v->device = device;
 	v->block_size = device_block_size(device);
 	v->refcount = 1;
-	v->disk = *sb;
+	v->disk.super = *sb;
 
 	page_free(b);
 
-	printf("diskfs: %d bitmap blocks, %d inode blocks, %d data blocks\n",
-		v->disk.bitmap_blocks,
-		v->disk.inode_blocks,
-		v->disk.data_blocks);
+	printf("diskfs: %d journal blocks, %d bitmap blocks, %d inode blocks, %d data blocks\n",
+		v->disk.super.journal_blocks,
+		v->disk.super.bitmap_blocks,
+		v->disk.super.inode_blocks,
+		v->disk.super.data_blocks);
+
+	v->disk.journal = diskfs_journal_open(device,&v->disk.super);
 
 	return v;
 }
@@ -530,6 +1477,10 @@ struct fs_dirent * diskfs_volume_root( struct fs_volume *v )
 
 int diskfs_volume_close( struct fs_volume *v )
 {
+	if(v->disk.journal) {
+		diskfs_journal_close(v->disk.journal);
+		v->disk.journal = 0;
+	}
 	return 0;
 }
 
@@ -545,17 +1496,19 @@ int diskfs_volume_format( struct device *device )
 	sb.magic = DISKFS_MAGIC;
 	sb.block_size = DISKFS_BLOCK_SIZE;
 	sb.inode_blocks = 1024 / sizeof(struct diskfs_inode);
+	sb.journal_blocks = DISKFS_JOURNAL_BLOCKS;
 
-	int remaining_blocks = nblocks - sb.inode_blocks;
+	int remaining_blocks = nblocks - 1 - sb.journal_blocks - sb.inode_blocks;
 	sb.bitmap_blocks = 1 + remaining_blocks / (DISKFS_BLOCK_SIZE*8);
 	sb.data_blocks = remaining_blocks - sb.bitmap_blocks;
 
-	sb.inode_start = 1;
+	sb.journal_start = 1;
+	sb.inode_start = sb.journal_start + sb.journal_blocks;
 	sb.bitmap_start = sb.inode_start + sb.inode_blocks;
 	sb.data_start = sb.bitmap_start + sb.bitmap_blocks;
 
-	printf("diskfs: %d inode blocks, %d bitmap blocks, %d data blocks\n",
-	       sb.inode_blocks, sb.bitmap_blocks, sb.data_blocks );
+	printf("diskfs: %d journal blocks, %d inode blocks, %d bitmap blocks, %d data blocks\n",
+	       sb.journal_blocks, sb.inode_blocks, sb.bitmap_blocks, sb.data_blocks );
 
 	memset(b,0,DISKFS_BLOCK_SIZE);
 	b->superblock = sb;
@@ -567,6 +1520,19 @@ int diskfs_volume_format( struct device *device )
 
 	int i;
 
+	printf("diskfs: writing %d journal blocks\n",sb.journal_blocks);
+
+	for(i=sb.journal_blocks-1;i>0;i--) {
+		diskfs_block_write(device,b,sb.journal_start+i);
+	}
+
+	b->journal.magic = DISKFS_JOURNAL_MAGIC;
+	b->journal.sequence = 1;
+	b->journal.start = 0;
+	diskfs_block_write(device,b,sb.journal_start);
+
+	memset(b,0,DISKFS_BLOCK_SIZE);
+
 	printf("diskfs: writing %d inode blocks\n",sb.inode_blocks);
 
 	for(i=sb.inode_blocks-1;i>=0;i--) {
@@ -587,7 +1553,7 @@ int diskfs_volume_format( struct device *device )
 
 	// Set up the zeroth inode as the root directory with a single direct block.
 	memset(b,0,DISKFS_BLOCK_SIZE);
-	b->inodes[0].inuse = 1;
+	b->inodes[0].flags = DISKFS_INODE_INUSE;
 	b->inodes[0].size = sizeof(struct diskfs_item);
 	b->inodes[0].direct[0] = 1;
 	diskfs_block_write(device,b,sb.inode_start);
@@ -620,8 +1586,12 @@ struct fs_ops diskfs_ops = {
 	.read_block = diskfs_dirent_read_block,
 	.write_block = diskfs_dirent_write_block,
 	.list = diskfs_dirent_list,
+	.readdir = diskfs_dirent_readdir,
 	.remove = diskfs_dirent_remove,
 	.resize = diskfs_dirent_resize,
+	.sync = diskfs_dirent_sync,
+	.extents = diskfs_dirent_extents,
+	.defrag = diskfs_dirent_defrag,
 	.close = diskfs_dirent_close
 };
 
@@ -16,6 +16,28 @@ See the file LICENSE for details.
 #define DISKFS_ITEMS_PER_BLOCK (DISKFS_BLOCK_SIZE/sizeof(struct diskfs_item))
 #define DISKFS_POINTERS_PER_BLOCK (DISKFS_BLOCK_SIZE/sizeof(uint32_t))
 
+/*
+The disk is laid out as follows, with all offsets measured in blocks:
+
+superblock | journal | inodes | bitmap | data
+
+The journal is a circular log of metadata updates.  Its first block
+is a header giving the position and sequence number of the oldest
+transaction that may not yet be written to its home location.
+Each transaction in the log is a descriptor block listing the home
+block numbers, followed by a copy of each of those blocks, followed
+by a commit block.  A transaction is only replayed at mount time if
+its commit block is present.  A disk with no journal blocks is
+updated in place, as before the journal existed.
+*/
+
+#define DISKFS_JOURNAL_MAGIC 0x4a4e4c21
+#define DISKFS_JOURNAL_BLOCKS 64
+#define DISKFS_JOURNAL_TXN_BLOCKS 32
+
+#define DISKFS_JOURNAL_DESCRIPTOR 1
+#define DISKFS_JOURNAL_COMMIT 2
+
 struct diskfs_superblock {
 	uint32_t magic;
 	uint32_t block_size;
@@ -25,13 +47,45 @@ struct diskfs_superblock {
 	uint32_t bitmap_blocks;
 	uint32_t data_start;
 	uint32_t data_blocks;
+	uint32_t journal_start;
+	uint32_t journal_blocks;
+};
+
+struct diskfs_journal_header {
+	uint32_t magic;
+	uint32_t sequence;	// sequence number of the oldest live transaction
+	uint32_t start;		// log position of that transaction
+};
+
+struct diskfs_journal_record {
+	uint32_t magic;
+	uint32_t type;		// DISKFS_JOURNAL_DESCRIPTOR or DISKFS_JOURNAL_COMMIT
+	uint32_t sequence;
+	uint32_t count;
+	uint32_t targets[DISKFS_JOURNAL_TXN_BLOCKS];
 };
 
+#define DISKFS_INODE_INUSE 1
+#define DISKFS_INODE_INLINE 2
+
+/*
+A file of no more than DISKFS_INLINE_SIZE bytes may be stored
+in the inode itself, in place of the block pointers, and is then
+marked DISKFS_INODE_INLINE.  It moves to a data block as it grows.
+*/
+
+#define DISKFS_INLINE_SIZE ((DISKFS_DIRECT_POINTERS+1)*sizeof(uint32_t))
+
 struct diskfs_inode {
-	uint32_t inuse; // reserve for broader use.
+	uint32_t flags;
 	uint32_t size;
-	uint32_t direct[DISKFS_DIRECT_POINTERS];
-	uint32_t indirect;
+	union {
+		struct {
+			uint32_t direct[DISKFS_DIRECT_POINTERS];
+			uint32_t indirect;
+		};
+		char data[DISKFS_INLINE_SIZE];
+	};
 };
 
 #define DISKFS_ITEM_BLANK 0
@@ -50,6 +104,8 @@ struct diskfs_item {
 struct diskfs_block {
 	union {
 		struct diskfs_superblock superblock;
+		struct diskfs_journal_header journal;
+		struct diskfs_journal_record record;
 		struct diskfs_inode inodes[DISKFS_INODES_PER_BLOCK];
 		struct diskfs_item items[DISKFS_ITEMS_PER_BLOCK];
 		uint32_t pointers[DISKFS_POINTERS_PER_BLOCK];
@@ -57,6 +113,19 @@ struct diskfs_block {
 	};
 };
 
+struct diskfs_volume {
+	struct diskfs_superblock super;
+	struct diskfs_journal *journal;
+};
+
 int diskfs_init(void);
 
+/*
+Commit each running journal transaction that has been open too long,
+returning true if there was one.  Called by the idle loop.
+*/
+
+int  diskfs_journal_commit_expired();
+void diskfs_journal_commit_all();
+
 #endif
@@ -117,7 +117,13 @@ int elf_load(struct process *p, const char *filename, addr_t * entry)
 	if(program.type != ELF_PROGRAM_TYPE_LOADABLE || program.vaddr < PROCESS_ENTRY_POINT || program.memory_size > 0x8000000 || program.memory_size != program.file_size)
 		goto noexec;
 
-	process_data_size_set(p, program.memory_size);
+	// Drop any previous image, so that the new one starts from zeroed pages.
+	process_data_size_set(p, 0);
+	if(process_data_size_set(p, program.memory_size) < 0)
+		goto mustdie;
+
+	// The image is read in by the kernel, perhaps for another process, so map it now.
+	pagetable_alloc(p->pagetable, program.vaddr, program.memory_size, PAGE_FLAG_USER | PAGE_FLAG_READWRITE | PAGE_FLAG_CLEAR);
 
 	actual = fs_dirent_read(d, (char *) program.vaddr, program.memory_size, program.offset);
 	if(actual != program.memory_size)
@@ -130,9 +136,10 @@ int elf_load(struct process *p, const char *filename, addr_t * entry)
 
 		if(section.type == ELF_SECTION_TYPE_BSS) {
 			uint32_t limit = section.address + section.size - PROCESS_ENTRY_POINT;
+			// The BSS is only reserved, and zeroed a page at a time as it is touched.
 			if(limit > p->vm_data_size) {
-				process_data_size_set(p, section.address + section.size - PROCESS_ENTRY_POINT);
-				memset((void *) section.address, section.size, 0);
+				if(process_data_size_set(p, limit) < 0)
+					goto mustdie;
 			}
 		} else {
 			/* skip all other section types */
@@ -11,9 +11,58 @@ See the file LICENSE for details.
 #include "page.h"
 #include "process.h"
 #include "bcache.h"
+#include "pcache.h"
+#include "slab.h"
 
 static struct fs *fs_list = 0;
 
+/*
+Dirents come and go on every path lookup, so they have a cache of their own.
+Paths are copied into a fixed size buffer from another cache,
+unless they are too long for it.
+*/
+
+#define FS_PATH_BUFFER 256
+
+static struct slab_cache dirent_cache = SLAB_CACHE_INIT("fs_dirent", sizeof(struct fs_dirent), 0);
+static struct slab_cache path_cache = SLAB_CACHE_INIT("path", FS_PATH_BUFFER, 0);
+
+struct fs_dirent *fs_dirent_alloc()
+{
+	struct fs_dirent *d = slab_alloc(&dirent_cache);
+	if(d)
+		memset(d, 0, sizeof(*d));
+	return d;
+}
+
+/*
+A mount attaches the root of one volume to a directory of another.
+The covered directory is identified by its volume and inode number,
+so that every later lookup of that directory, by any path, is
+redirected to the root of the mounted volume.  The covered directory
+is kept open, so that .. at the mounted root can lead back out.
+*/
+
+struct fs_mount {
+	struct fs_dirent *covered;
+	struct fs_dirent *root;
+	struct fs_mount *next;
+};
+
+static struct fs_mount *mount_list = 0;
+
+static struct fs_mount *fs_mount_find(struct fs_volume *v, int inumber)
+{
+	struct fs_mount *m;
+
+	for(m = mount_list; m; m = m->next) {
+		if(m->covered->volume == v && m->covered->inumber == inumber)
+			return m;
+	}
+
+	return 0;
+}
+
 static struct kobject * find_kobject_by_tag( const char *tag )
 {
 	int i;
@@ -77,6 +126,41 @@ struct fs_dirent *fs_resolve(const char *path)
 	return fs_dirent_traverse(current->current_dir, path);
 }
 
+/*
+Create the file named by path, in a directory that already exists.
+The directory is resolved as path up to the last slash, followed by
+".", so that the lookup of "." supplies the reference that is closed.
+*/
+
+struct fs_dirent *fs_resolve_mkfile(const char *path)
+{
+	const char *name = path;
+	const char *slash;
+
+	while((slash = strchr(name, '/')))
+		name = slash + 1;
+	if(!*name)
+		return 0;
+
+	int length = name - path;
+	char *dirpath = kmalloc(length + 2);
+	if(!dirpath)
+		return 0;
+	memcpy(dirpath, path, length);
+	strcpy(&dirpath[length], ".");
+
+	struct fs_dirent *parent = fs_resolve(dirpath);
+	kfree(dirpath);
+	if(!parent)
+		return 0;
+
+	struct fs_dirent *d = 0;
+	if(fs_dirent_isdir(parent))
+		d = fs_dirent_mkfile(parent, name);
+	fs_dirent_close(parent);
+	return d;
+}
+
 void fs_register(struct fs *f)
 {
 	f->next = fs_list;
@@ -113,7 +197,7 @@ struct fs_volume *fs_volume_open(struct fs *f, struct device *d )
 	struct fs_volume *v = f->ops->volume_open(d);
 	if(v) {
 		v->fs = f;
-		v->device = device_addref(d);
+		v->device = d ? device_addref(d) : 0;
 	}
 	return v;
 }
@@ -133,8 +217,10 @@ int fs_volume_close(struct fs_volume *v)
 	v->refcount--;
 	if(v->refcount==0) {
 		v->fs->ops->volume_close(v);
-		bcache_flush_device(v->device);
-		device_close(v->device);
+		if(v->device) {
+			bcache_flush_device(v->device);
+			device_close(v->device);
+		}
 		kfree(v);
 	}
 
@@ -148,7 +234,7 @@ struct fs_dirent *fs_volume_root(struct fs_volume *v)
 		return 0;
 
 	struct fs_dirent *d = v->fs->ops->volume_root(v);
-	d->volume = fs_volume_addref(v);
+	if(d) d->volume = fs_volume_addref(v);
 	return d;
 }
 
@@ -160,21 +246,134 @@ int fs_dirent_list(struct fs_dirent *d, char *buffer, int buffer_length)
 	return ops->list(d, buffer, buffer_length);
 }
 
-static struct fs_dirent *fs_dirent_lookup(struct fs_dirent *d, const char *name)
+int fs_dirent_readdir(struct fs_dirent *d, char *buffer, int buffer_length, uint32_t *cookie)
+{
+	const struct fs_ops *ops = d->volume->fs->ops;
+	if(!d->isdir)
+		return KERROR_NOT_A_DIRECTORY;
+	if(!ops->readdir)
+		return KERROR_NOT_IMPLEMENTED;
+	return ops->readdir(d, buffer, buffer_length, cookie);
+}
+
+int fs_readdir_pack(char *buffer, int buffer_length, const char *name, int name_length, int isdir, uint32_t inumber, uint32_t size)
+{
+	// Round up so that each record starts on a four byte boundary.
+	int length = (sizeof(struct dir_entry) + name_length + 1 + 3) & ~3;
+	if(length > buffer_length)
+		return 0;
+
+	struct dir_entry *e = (struct dir_entry *) buffer;
+	e->inumber = inumber;
+	e->size = size;
+	e->type = isdir ? KOBJECT_DIR : KOBJECT_FILE;
+	e->length = length;
+	memcpy(e->name, name, name_length);
+	e->name[name_length] = 0;
+
+	return length;
+}
+
+int fs_dirent_mount(struct fs_dirent *d, struct fs_dirent *root)
+{
+	struct fs_mount *m;
+
+	if(!fs_dirent_isdir(d) || !fs_dirent_isdir(root))
+		return KERROR_NOT_A_DIRECTORY;
+
+	if(fs_mount_find(d->volume, d->inumber))
+		return KERROR_FILE_EXISTS;
+
+	m = kmalloc(sizeof(*m));
+	if(!m)
+		return KERROR_OUT_OF_MEMORY;
+
+	m->covered = fs_dirent_addref(d);
+	m->root = fs_dirent_addref(root);
+	m->next = mount_list;
+	mount_list = m;
+
+	return 0;
+}
+
+int fs_dirent_unmount(struct fs_dirent *root)
+{
+	struct fs_mount **pm;
+
+	for(pm = &mount_list; *pm; pm = &(*pm)->next) {
+		struct fs_mount *m = *pm;
+		if(m->root == root) {
+			*pm = m->next;
+			fs_dirent_close(m->root);
+			fs_dirent_close(m->covered);
+			kfree(m);
+			return 0;
+		}
+	}
+
+	return KERROR_NOT_FOUND;
+}
+
+/*
+If d is a directory covered by a mount, release it
+and return the root of the mounted volume instead.
+*/
+
+static struct fs_dirent *fs_dirent_cross_mount(struct fs_dirent *d)
+{
+	struct fs_mount *m;
+
+	if(!d->isdir)
+		return d;
+
+	m = fs_mount_find(d->volume, d->inumber);
+	if(m) {
+		fs_dirent_close(d);
+		return fs_dirent_addref(m->root);
+	}
+
+	return d;
+}
+
+/*
+Look up a name in the directory itself, without crossing
+into any volume mounted on the result.
+*/
+
+static struct fs_dirent *fs_dirent_lookup_covered(struct fs_dirent *d, const char *name)
 {
 	const struct fs_ops *ops = d->volume->fs->ops;
 
 	if(!ops->lookup)
 		return 0;
 
+	struct fs_dirent *r = ops->lookup(d, name);
+	if(r)
+		r->volume = fs_volume_addref(d->volume);
+	return r;
+}
+
+static struct fs_dirent *fs_dirent_lookup(struct fs_dirent *d, const char *name)
+{
+	struct fs_mount *m;
+
 	if(!strcmp(name,".")) {
 		// Special case: . refers to the containing directory.
 		return fs_dirent_addref(d);
-	} else {
-		struct fs_dirent *r = ops->lookup(d, name);
-		if(r) r->volume = fs_volume_addref(d->volume);
-		return r;
 	}
+
+	if(!strcmp(name,"..")) {
+		// Special case: .. at a mounted root leads out of the volume.
+		for(m = mount_list; m; m = m->next) {
+			if(m->root->volume == d->volume && m->root->inumber == d->inumber)
+				return fs_dirent_lookup(m->covered, name);
+		}
+	}
+
+	struct fs_dirent *r = fs_dirent_lookup_covered(d, name);
+	if(r)
+		r = fs_dirent_cross_mount(r);
+	return r;
 }
 
 struct fs_dirent *fs_dirent_traverse(struct fs_dirent *parent, const char *path)
@@ -182,7 +381,10 @@ struct fs_dirent *fs_dirent_traverse(struct fs_dirent *parent, const char *path)
 	if(!parent || !path)
 		return 0;
 
-	char *lpath = kmalloc(strlen(path) + 1);
+	int length = strlen(path) + 1;
+	char *lpath = length <= FS_PATH_BUFFER ? slab_alloc(&path_cache) : kmalloc(length);
+	if(!lpath)
+		return 0;
 	strcpy(lpath, path);
 
 	struct fs_dirent *d = parent;
@@ -195,13 +397,18 @@ struct fs_dirent *fs_dirent_traverse(struct fs_dirent *parent, const char *path)
 
 		if(!n) {
 			// KERROR_NOT_FOUND
-			kfree(lpath);
-			return 0;
+			d = 0;
+			break;
 		}
 		d = n;
 		part = strtok(0, "/");
 	}
-	kfree(lpath);
+
+	if(length <= FS_PATH_BUFFER) {
+		slab_free(&path_cache, lpath);
+	} else {
+		kfree(lpath);
+	}
 	return d;
 }
 
@@ -222,12 +429,24 @@ int fs_dirent_close(struct fs_dirent *d)
 		ops->close(d);
 		// This close is paired with the addref in fs_dirent_lookup
 		fs_volume_close(d->volume);
-		kfree(d);
+		slab_free(&dirent_cache, d);
 	}
 
 	return 0;
 }
 
+/*
+A filesystem whose dirents share one in-core file keeps the size
+there, so bring the dirent's copy up to date before relying on it.
+*/
+
+static void fs_dirent_refresh(struct fs_dirent *d)
+{
+	const struct fs_ops *ops = d->volume->fs->ops;
+	if(ops->size)
+		d->size = ops->size(d);
+}
+
 int fs_dirent_read(struct fs_dirent *d, char *buffer, uint32_t length, uint32_t offset)
 {
 	int total = 0;
@@ -237,6 +456,8 @@ int fs_dirent_read(struct fs_dirent *d, char *buffer, uint32_t length, uint32_t
 	if(!ops->read_block)
 		return KERROR_INVALID_REQUEST;
 
+	fs_dirent_refresh(d);
+
 	if(offset > d->size) {
 		return 0;
 	}
@@ -249,6 +470,9 @@ int fs_dirent_read(struct fs_dirent *d, char *buffer, uint32_t length, uint32_t
 	if(!temp)
 		return -1;
 
+	char *start = buffer;
+	uint32_t start_offset = offset;
+
 	while(length > 0) {
 
 		int blocknum = offset / bs;
@@ -279,12 +503,14 @@ int fs_dirent_read(struct fs_dirent *d, char *buffer, uint32_t length, uint32_t
 	}
 
 	page_free(temp);
+	pcache_read_overlay(d, start, total, start_offset);
 	return total;
 
       failure:
 	page_free(temp);
 	if(total == 0)
 		return -1;
+	pcache_read_overlay(d, start, total, start_offset);
 	return total;
 }
 
@@ -321,6 +547,19 @@ int fs_dirent_remove(struct fs_dirent *d, const char *name)
 	const struct fs_ops *ops = d->volume->fs->ops;
 	if(!ops->remove)
 		return 0;
+
+	struct fs_dirent *child = fs_dirent_lookup_covered(d, name);
+	if(child) {
+		// A directory with a volume mounted on it stays until the unmount.
+		if(fs_mount_find(child->volume, child->inumber)) {
+			fs_dirent_close(child);
+			return KERROR_BUSY;
+		}
+		// Pages of the file still mapped somewhere must not be written back.
+		pcache_invalidate(child);
+		fs_dirent_close(child);
+	}
+
 	return ops->remove(d, name);
 }
 
@@ -333,11 +572,20 @@ int fs_dirent_write(struct fs_dirent *d, const char *buffer, uint32_t length, ui
 	if(!ops->write_block || !ops->read_block)
 		return KERROR_INVALID_REQUEST;
 
+	fs_dirent_refresh(d);
+
 	char *temp = page_alloc(0);
 
+	const char *start = buffer;
+	uint32_t start_offset = offset;
+
 	// if writing past the (current) end of the file, resize the file first
 	if (offset + length > d->size) {
-		ops->resize(d, offset+length);
+		int result = ops->resize(d, offset+length);
+		if(result < 0) {
+			page_free(temp);
+			return result;
+		}
 	}
 
 	while(length > 0) {
@@ -381,17 +629,126 @@ int fs_dirent_write(struct fs_dirent *d, const char *buffer, uint32_t length, ui
 	}
 
 	page_free(temp);
+	pcache_write_update(d, start, total, start_offset);
 	return total;
 
       failure:
 	page_free(temp);
 	if(total == 0)
 		return -1;
+	pcache_write_update(d, start, total, start_offset);
+	return total;
+}
+
+/*
+Copy length bytes of src, starting at soffset, to dst at doffset,
+and return the number of bytes copied.  The destination is resized
+once, up front.  While both offsets fall on a block boundary and the
+block sizes agree, each block goes from one filesystem to the other
+through a single kernel page, with no read-modify-write of the target.
+*/
+
+int fs_dirent_transfer(struct fs_dirent *src, uint32_t soffset, struct fs_dirent *dst, uint32_t doffset, uint32_t length)
+{
+	const struct fs_ops *sops = src->volume->fs->ops;
+	const struct fs_ops *dops = dst->volume->fs->ops;
+	uint32_t sbs = src->volume->block_size;
+	uint32_t dbs = dst->volume->block_size;
+	int total = 0;
+
+	if(src->isdir || dst->isdir)
+		return KERROR_NOT_A_FILE;
+	if(!sops->read_block || !dops->write_block || !dops->read_block)
+		return KERROR_INVALID_REQUEST;
+
+	fs_dirent_refresh(src);
+	fs_dirent_refresh(dst);
+
+	if(soffset >= src->size)
+		return 0;
+	length = MIN(length, src->size - soffset);
+
+	char *temp = page_alloc(0);
+	if(!temp)
+		return KERROR_OUT_OF_MEMORY;
+
+	if(doffset + length > dst->size && dops->resize) {
+		int result = dops->resize(dst, doffset + length);
+		if(result < 0) {
+			page_free(temp);
+			return result;
+		}
+	}
+
+	while(length > 0) {
+		int actual;
+
+		if(sbs == dbs && soffset % sbs == 0 && doffset % dbs == 0 && length >= sbs) {
+			// Mapped pages of either file are newer than the blocks below them.
+			if(sops->read_block(src, temp, soffset / sbs) != sbs)
+				break;
+			pcache_read_overlay(src, temp, sbs, soffset);
+			if(dops->write_block(dst, temp, doffset / dbs) != dbs)
+				break;
+			pcache_write_update(dst, temp, dbs, doffset);
+			actual = sbs;
+		} else {
+			actual = fs_dirent_read(src, temp, MIN(length, sbs - soffset % sbs), soffset);
+			if(actual <= 0)
+				break;
+			actual = fs_dirent_write(dst, temp, actual, doffset);
+			if(actual <= 0)
+				break;
+		}
+
+		soffset += actual;
+		doffset += actual;
+		length -= actual;
+		total += actual;
+	}
+
+	page_free(temp);
 	return total;
 }
 
+int fs_dirent_sync(struct fs_dirent *d, int datasync)
+{
+	const struct fs_ops *ops = d->volume->fs->ops;
+
+	pcache_flush(d);
+
+	// Without a sync of its own, a filesystem on a device gets a full flush.
+	if(ops->sync) {
+		return ops->sync(d, datasync);
+	} else if(d->volume->device) {
+		bcache_flush_device(d->volume->device);
+	}
+
+	return 0;
+}
+
+int fs_dirent_extents(struct fs_dirent *d, struct fs_extent_stats *s)
+{
+	const struct fs_ops *ops = d->volume->fs->ops;
+	if(!ops->extents)
+		return KERROR_NOT_IMPLEMENTED;
+	return ops->extents(d, s);
+}
+
+int fs_dirent_defrag(struct fs_dirent *d)
+{
+	const struct fs_ops *ops = d->volume->fs->ops;
+	if(!ops->defrag)
+		return KERROR_NOT_IMPLEMENTED;
+	// Mapped pages would be written back over the old block locations.
+	if(pcache_mapped(d))
+		return KERROR_BUSY;
+	return ops->defrag(d);
+}
+
 int fs_dirent_size(struct fs_dirent *d)
 {
+	fs_dirent_refresh(d);
 	return d->size;
 }
 
@@ -400,82 +757,87 @@ int fs_dirent_isdir( struct fs_dirent *d )
 	return d->isdir;
 }
 
-int fs_dirent_copy(struct fs_dirent *src, struct fs_dirent *dst, int depth )
-{
-	char *buffer = page_alloc(1);
+/*
+Copy one entry of a directory listing from src into dst,
+recursively if it is a directory.  The type and size come
+from the listing, so the source is only opened to read it.
+*/
 
-	int length = fs_dirent_list(src, buffer, PAGE_SIZE);
-	if (length <= 0) goto failure;
+static int fs_dirent_copy_entry(struct fs_dirent *src, struct fs_dirent *dst, struct dir_entry *e, int depth)
+{
+	// Skip relative directory entries.
+	if (strcmp(e->name,".") == 0 || (strcmp(e->name, "..") == 0)) {
+		return 0;
+	}
 
-	char *name = buffer;
-	while (name && (name - buffer) < length) {
+	int i;
+	for(i=0;i<depth;i++) printf(">");
 
-		// Skip relative directory entries.
-		if (strcmp(name,".") == 0 || (strcmp(name, "..") == 0)) {
-			goto next_entry;
-		}
+	if(e->type==KOBJECT_DIR) {
+		printf("%s (dir)\n", e->name);
+	} else {
+		printf("%s (%d bytes)\n", e->name, e->size);
+	}
 
-		struct fs_dirent *new_src = fs_dirent_lookup(src, name);
-		if(!new_src) {
-			printf("couldn't lookup %s in directory!\n",name);
-			goto next_entry;
-		}
+	struct fs_dirent *new_src = fs_dirent_lookup(src, e->name);
+	if(!new_src) {
+		printf("couldn't lookup %s in directory!\n",e->name);
+		return 0;
+	}
 
-		int i;
-		for(i=0;i<depth;i++) printf(">");
+	struct fs_dirent *new_dst;
+	if(e->type==KOBJECT_DIR) {
+		new_dst = fs_dirent_mkdir(dst,e->name);
+	} else {
+		new_dst = fs_dirent_mkfile(dst,e->name);
+	}
 
-		if(fs_dirent_isdir(new_src)) {
-			printf("%s (dir)\n", name);
-			struct fs_dirent *new_dst = fs_dirent_mkdir(dst,name);
-			if(!new_dst) {
-				printf("couldn't create %s!\n",name);
-				fs_dirent_close(new_src);
-				goto next_entry;
-			}
-			int res = fs_dirent_copy(new_src, new_dst,depth+1);
-			fs_dirent_close(new_dst);
-			if(res<0) goto failure;
-		} else {
-			printf("%s (%d bytes)\n", name,fs_dirent_size(new_src));
-			struct fs_dirent *new_dst = fs_dirent_mkfile(dst, name);
-			if(!new_dst) {
-				printf("couldn't create %s!\n",name);
-				fs_dirent_close(new_src);
-				goto next_entry;
-			}
+	if(!new_dst) {
+		printf("couldn't create %s!\n",e->name);
+		fs_dirent_close(new_src);
+		return 0;
+	}
 
-			char * filebuf = page_alloc(0);
-			if (!filebuf) {
-				fs_dirent_close(new_src);
-				fs_dirent_close(new_dst);
-				goto failure;
-			}
+	int result = 0;
 
-			uint32_t file_size = fs_dirent_size(new_src);
-			uint32_t offset = 0;
+	if(e->type==KOBJECT_DIR) {
+		result = fs_dirent_copy(new_src, new_dst, depth+1);
+	} else {
+		int actual = fs_dirent_transfer(new_src, 0, new_dst, 0, e->size);
+		if(actual < 0) {
+			result = actual;
+		} else if(actual != e->size) {
+			printf("couldn't copy all of %s!\n", e->name);
+		}
+	}
 
-			while(offset<file_size) {
-				uint32_t chunk = MIN(PAGE_SIZE,file_size-offset);
-				fs_dirent_read(new_src, filebuf, chunk, offset );
-				fs_dirent_write(new_dst, filebuf, chunk, offset );
-				offset += chunk;
-			}
+	fs_dirent_close(new_dst);
+	fs_dirent_close(new_src);
 
-			page_free(filebuf);
+	return result;
+}
 
-			fs_dirent_close(new_dst);
+int fs_dirent_copy(struct fs_dirent *src, struct fs_dirent *dst, int depth )
+{
+	char *buffer = page_alloc(1);
+	if(!buffer) return KERROR_OUT_OF_MEMORY;
+
+	uint32_t cookie = 0;
+	int length;
+
+	while((length = fs_dirent_readdir(src, buffer, PAGE_SIZE, &cookie)) > 0) {
+		int offset = 0;
+		while(offset < length) {
+			struct dir_entry *e = (struct dir_entry *) &buffer[offset];
+			int result = fs_dirent_copy_entry(src, dst, e, depth);
+			if(result<0) {
+				page_free(buffer);
+				return result;
+			}
+			offset += e->length;
 		}
-
-		fs_dirent_close(new_src);
-
-		next_entry:
-		name += strlen(name) + 1;
 	}
 
 	page_free(buffer);
-	return 0;
-
-failure:
-	page_free(buffer);
-	return KERROR_NOT_FOUND;
+	return length;
 }
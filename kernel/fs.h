@@ -21,10 +21,12 @@ struct fs_file;
 /*
 fs_resolve is the most common interface to the filesystem code.
 Given a path, it interprets it in the context of the current
-process and returns a dirent.
+process and returns a dirent.  fs_resolve_mkfile creates
+a new file at the path instead.
 */
 
 struct fs_dirent *fs_resolve(const char *path);
+struct fs_dirent *fs_resolve_mkfile(const char *path);
 
 /*
 fs_lookup returns the filesystem driver corresponding to
@@ -36,7 +38,8 @@ struct fs *fs_lookup(const char *name);
 /*
 A volume is an instance of a filesystem stored on a block device.
 To begin using a filesystem, open the volume and retrieve the
-root directory entry with fs_volume_root.
+root directory entry with fs_volume_root.  The device may be
+null for filesystems that keep their data in memory, such as tmpfs.
 */
 
 int fs_volume_format(struct fs *f, struct device *d);
@@ -62,8 +65,57 @@ int fs_dirent_remove(struct fs_dirent *d, const char *name);
 int fs_dirent_size(struct fs_dirent *d );
 int fs_dirent_isdir(struct fs_dirent *d);
 int fs_dirent_close(struct fs_dirent *d);
+
+/*
+Write the cached blocks of one file to its device.  If datasync
+is set, only what is needed to read the data back is written.
+*/
+
+int fs_dirent_sync(struct fs_dirent *d, int datasync);
 int fs_dirent_copy( struct fs_dirent *src, struct fs_dirent *dst, int depth );
 
+/*
+transfer copies a byte range from one file to another in the kernel,
+going block to block when both offsets are block aligned.
+*/
+
+int fs_dirent_transfer(struct fs_dirent *src, uint32_t soffset, struct fs_dirent *dst, uint32_t doffset, uint32_t length);
+
+/*
+extents reports the layout of a file and the free space of its volume,
+and defrag moves the blocks of a file into a single contiguous run.
+*/
+
+int fs_dirent_extents(struct fs_dirent *d, struct fs_extent_stats *s);
+int fs_dirent_defrag(struct fs_dirent *d);
+
+/*
+readdir fills buffer with struct dir_entry records, starting at the
+position given by cookie, and advances cookie past the entries returned.
+A cookie of zero starts at the beginning, and a return of zero means
+there are no more entries.  Filesystems use fs_readdir_pack to append
+a single entry: it returns the bytes used, or zero if it does not fit.
+*/
+
+int fs_dirent_readdir(struct fs_dirent *d, char *buffer, int buffer_length, uint32_t *cookie);
+int fs_readdir_pack(char *buffer, int buffer_length, const char *name, int name_length, int isdir, uint32_t inumber, uint32_t size);
+
+/*
+Filesystems obtain each new dirent from fs_dirent_alloc, which returns
+it zeroed, and it is released by fs_dirent_close on the last reference.
+*/
+
+struct fs_dirent *fs_dirent_alloc();
+
+/*
+Mount the root directory of another volume on top of directory d,
+so that lookups of d return root instead.  Unmount is given the
+mounted root, which is what a path to the mount point resolves to.
+*/
+
+int fs_dirent_mount(struct fs_dirent *d, struct fs_dirent *root);
+int fs_dirent_unmount(struct fs_dirent *root);
+
 /*
 Register a new filesystem type, typically at system startup.
 */
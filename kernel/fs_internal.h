@@ -10,6 +10,8 @@ See the file LICENSE for details.
 #include "fs.h"
 #include "cdromfs.h"
 #include "diskfs.h"
+#include "imagefs.h"
+#include "tmpfs.h"
 
 struct fs {
 	char *name;
@@ -24,7 +26,9 @@ struct fs_volume {
 	int refcount;
 	union {
 		struct cdrom_volume cdrom;
-		struct diskfs_superblock disk;
+		struct diskfs_volume disk;
+		struct imagefs_volume image;
+		struct tmpfs_volume tmp;
 	};
 };
 
@@ -37,6 +41,8 @@ struct fs_dirent {
 	union {
 		struct cdrom_dirent cdrom;
 		struct diskfs_inode disk;
+		struct imagefs_inode image;
+		struct tmpfs_dirent tmp;
 	};
 };
 
@@ -53,8 +59,13 @@ struct fs_ops {
 	int (*read_block) (struct fs_dirent *d, char *buffer, uint32_t blocknum);
 	int (*write_block) (struct fs_dirent *d, const char *buffer, uint32_t blocknum);
 	int (*list) (struct fs_dirent *d, char *buffer, int buffer_length);
+	int (*readdir) (struct fs_dirent *d, char *buffer, int buffer_length, uint32_t *cookie);
 	int (*remove) (struct fs_dirent *d, const char *name);
 	int (*resize) (struct fs_dirent *d, uint32_t blocks);
+	uint32_t (*size) (struct fs_dirent *d);
+	int (*sync) (struct fs_dirent *d, int datasync);
+	int (*extents) (struct fs_dirent *d, struct fs_extent_stats *s);
+	int (*defrag) (struct fs_dirent *d);
 	int (*close) (struct fs_dirent *d);
 };
 
@@ -9,10 +9,14 @@ See the file LICENSE for details.
 #include "ioports.h"
 #include "font.h"
 #include "string.h"
-#include "kmalloc.h"
+#include "slab.h"
 #include "bitmap.h"
 #include "string.h"
 #include "process.h"
+#include "page.h"
+#include "clock.h"
+#include "console.h"
+#include "kernel/error.h"
 
 #define FACTOR 256
 
@@ -52,9 +56,11 @@ struct graphics *graphics_create_root()
 	return g;
 }
 
+static struct slab_cache graphics_cache = SLAB_CACHE_INIT("graphics", sizeof(struct graphics), 0);
+
 struct graphics *graphics_create(struct graphics *parent )
 {
-	struct graphics *g = kmalloc(sizeof(*g));
+	struct graphics *g = slab_alloc(&graphics_cache);
 	if(!g) return 0;
 
 	memcpy(g, parent, sizeof(*g));
@@ -81,7 +87,7 @@ void graphics_delete( struct graphics *g )
 	g->refcount--;
 	if(g->refcount==0) {
 		graphics_delete(g->parent);
-		kfree(g);
+		slab_free(&graphics_cache, g);
 	}
 }
 
@@ -395,3 +401,72 @@ void graphics_scrollup(struct graphics *g, int x, int y, int w, int h, int dy)
 
 	graphics_clear(g, x, y + h - dy, w, dy);
 }
+
+#define GRAPHICS_BENCH_ROUNDS 16
+#define GRAPHICS_BENCH_ORDER 8
+
+static void graphics_bench_report(const char *what, uint32_t bytes, clock_t elapsed)
+{
+	uint32_t ms = elapsed.seconds * 1000 + elapsed.millis;
+	printf("graphics: %s %d KB in %d ms", what, bytes / KILO, ms);
+	if(ms > 0)
+		printf(" (%d MB/s)", bytes / KILO * 1000 / ms / KILO);
+	printf("\n");
+}
+
+/*
+Measure the throughput of filling and copying the framebuffer, and
+of copying main memory, which between them show the cost of the
+mappings and TLB misses behind screen drawing and block copies.
+The screen is overwritten, and cleared at the end.
+*/
+
+int graphics_bench()
+{
+	struct graphics *g = &graphics_root;
+	struct graphics_color fgcolor = g->fgcolor;
+	uint32_t w = g->clip.w;
+	uint32_t h = g->clip.h;
+	uint32_t screen = w * h * 3;
+	clock_t start;
+	int i;
+
+	start = clock_read();
+	for(i = 0; i < GRAPHICS_BENCH_ROUNDS; i++) {
+		struct graphics_color c = { i * 16, 255 - i * 16, 128, 0 };
+		g->fgcolor = c;
+		graphics_rect(g, 0, 0, w, h);
+	}
+	graphics_bench_report("fill", screen * GRAPHICS_BENCH_ROUNDS, clock_diff(start, clock_read()));
+	g->fgcolor = fgcolor;
+
+	start = clock_read();
+	for(i = 0; i < GRAPHICS_BENCH_ROUNDS; i++) {
+		graphics_scrollup(g, 0, 0, w, h, 1);
+	}
+	graphics_bench_report("copy", screen * GRAPHICS_BENCH_ROUNDS, clock_diff(start, clock_read()));
+
+	graphics_clear(g, 0, 0, w, h);
+
+	uint32_t length = PAGE_SIZE << GRAPHICS_BENCH_ORDER;
+	char *src = page_alloc_order(GRAPHICS_BENCH_ORDER, 0);
+	char *dst = page_alloc_order(GRAPHICS_BENCH_ORDER, 0);
+	if(!src || !dst) {
+		if(src)
+			page_free_order(src, GRAPHICS_BENCH_ORDER);
+		if(dst)
+			page_free_order(dst, GRAPHICS_BENCH_ORDER);
+		return KERROR_OUT_OF_MEMORY;
+	}
+
+	start = clock_read();
+	for(i = 0; i < GRAPHICS_BENCH_ROUNDS; i++) {
+		memcpy(dst, src, length);
+	}
+	graphics_bench_report("memcpy", length * GRAPHICS_BENCH_ROUNDS, clock_diff(start, clock_read()));
+
+	page_free_order(src, GRAPHICS_BENCH_ORDER);
+	page_free_order(dst, GRAPHICS_BENCH_ORDER);
+
+	return 0;
+}
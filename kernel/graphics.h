@@ -38,4 +38,6 @@ void graphics_char(struct graphics *g, int x, int y, unsigned char c);
 
 int graphics_write(struct graphics *g, struct graphics_command *command);
 
+int graphics_bench();
+
 #endif
@@ -0,0 +1,452 @@
+/*
+Copyright (C) 2016-2019 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file LICENSE for details.
+*/
+
+#include "kernel/types.h"
+#include "kernel/error.h"
+#include "kmalloc.h"
+#include "imagefs.h"
+#include "string.h"
+#include "fs.h"
+#include "fs_internal.h"
+#include "device.h"
+#include "list.h"
+#include "page.h"
+#include "lz4.h"
+
+/*
+Decompressed blocks are kept in a small LRU cache, shared by
+all mounted images, so that a block is only read from the device
+and decompressed once while it is in active use.  The compressed
+data is read with device_read rather than through the bcache,
+since each compressed block is consumed exactly once per miss.
+*/
+
+#define IMAGEFS_CACHE_SIZE 32
+
+struct imagefs_block {
+	struct list_node node;
+	struct fs_volume *volume;
+	uint32_t extent;
+	char *data;
+};
+
+static struct list cache = LIST_INIT;
+
+/* Read an arbitrary byte range of the image from the underlying device. */
+
+static int imagefs_image_read(struct fs_volume *v, char *data, uint32_t length, uint32_t offset)
+{
+	int bs = device_block_size(v->device);
+
+	char *temp = page_alloc(0);
+	if(!temp)
+		return KERROR_OUT_OF_MEMORY;
+
+	while(length > 0) {
+		uint32_t block = offset / bs;
+		uint32_t skip = offset % bs;
+		uint32_t actual;
+
+		if(skip == 0 && length >= bs) {
+			actual = (length / bs) * bs;
+			if(device_read(v->device, data, actual / bs, block) < 1)
+				goto failure;
+		} else {
+			actual = MIN(bs - skip, length);
+			if(device_read(v->device, temp, 1, block) < 1)
+				goto failure;
+			memcpy(data, &temp[skip], actual);
+		}
+
+		data += actual;
+		length -= actual;
+		offset += actual;
+	}
+
+	page_free(temp);
+	return 0;
+
+      failure:
+	page_free(temp);
+	return -1;
+}
+
+/*
+Load extent n of the volume into a cache entry.
+length is the number of uncompressed bytes expected:
+a full block, except at the end of a file.
+*/
+
+static int imagefs_block_load(struct fs_volume *v, struct imagefs_block *b, uint32_t n, uint32_t length)
+{
+	struct imagefs_extent *e = &v->image.extents[n];
+	uint32_t clength = e->length & ~IMAGEFS_EXTENT_RAW;
+
+	if(clength > v->block_size)
+		return KERROR_INVALID_REQUEST;
+
+	memset(b->data, 0, v->block_size);
+
+	if(e->length & IMAGEFS_EXTENT_RAW) {
+		return imagefs_image_read(v, b->data, clength, e->offset);
+	}
+
+	char *temp = page_alloc(0);
+	if(!temp)
+		return KERROR_OUT_OF_MEMORY;
+
+	int result = imagefs_image_read(v, temp, clength, e->offset);
+	if(result == 0) {
+		if(lz4_decompress(temp, clength, b->data, v->block_size) != length) {
+			printf("imagefs: block %d is corrupted\n", n);
+			result = -1;
+		}
+	}
+
+	page_free(temp);
+	return result;
+}
+
+static struct imagefs_block *imagefs_block_get(struct fs_volume *v, uint32_t n, uint32_t length)
+{
+	struct list_node *node;
+	struct imagefs_block *b;
+
+	for(node = cache.head; node; node = node->next) {
+		b = (struct imagefs_block *) node;
+		if(b->volume == v && b->extent == n) {
+			list_remove(&b->node);
+			list_push_head(&cache, &b->node);
+			return b;
+		}
+	}
+
+	if(list_size(&cache) >= IMAGEFS_CACHE_SIZE) {
+		b = (struct imagefs_block *) list_pop_tail(&cache);
+	} else {
+		b = kmalloc(sizeof(*b));
+		if(!b)
+			return 0;
+		b->data = page_alloc(0);
+		if(!b->data) {
+			kfree(b);
+			return 0;
+		}
+	}
+
+	if(imagefs_block_load(v, b, n, length) < 0) {
+		page_free(b->data);
+		kfree(b);
+		return 0;
+	}
+
+	b->volume = v;
+	b->extent = n;
+	list_push_head(&cache, &b->node);
+
+	return b;
+}
+
+static void imagefs_cache_purge(struct fs_volume *v)
+{
+	struct list_node *node = cache.head;
+
+	while(node) {
+		struct imagefs_block *b = (struct imagefs_block *) node;
+		node = node->next;
+		if(b->volume == v) {
+			list_remove(&b->node);
+			page_free(b->data);
+			kfree(b);
+		}
+	}
+}
+
+static struct fs_dirent *imagefs_dirent_create(struct fs_volume *v, uint32_t inumber)
+{
+	if(inumber >= v->image.super.inode_count)
+		return 0;
+
+	struct fs_dirent *d = fs_dirent_alloc();
+	if(!d)
+		return 0;
+
+	d->volume = v;
+	d->refcount = 1;
+	d->inumber = inumber;
+	d->image = v->image.inodes[inumber];
+	d->size = d->image.size;
+	d->isdir = d->image.type == IMAGEFS_ITEM_DIR;
+
+	return d;
+}
+
+static int imagefs_dirent_read_block(struct fs_dirent *d, char *buffer, uint32_t blocknum)
+{
+	uint32_t bs = d->volume->block_size;
+
+	if(d->isdir || blocknum * bs >= d->size)
+		return -1;
+
+	uint32_t length = MIN(bs, d->size - blocknum * bs);
+
+	struct imagefs_block *b = imagefs_block_get(d->volume, d->image.start + blocknum, length);
+	if(!b)
+		return -1;
+
+	memcpy(buffer, b->data, bs);
+	return bs;
+}
+
+static struct fs_dirent *imagefs_dirent_lookup(struct fs_dirent *d, const char *name)
+{
+	if(!d->isdir)
+		return 0;
+
+	int name_length = strlen(name);
+	char *p = d->volume->image.dirs + d->image.start;
+	char *end = p + d->image.size;
+
+	while(p < end) {
+		struct imagefs_item *r = (struct imagefs_item *) p;
+		if(r->name_length == name_length && !strncmp(name, r->name, name_length)) {
+			return imagefs_dirent_create(d->volume, r->inumber);
+		}
+		p += sizeof(*r) + r->name_length;
+	}
+
+	return 0;
+}
+
+static int imagefs_dirent_list(struct fs_dirent *d, char *buffer, int buffer_length)
+{
+	if(!d->isdir)
+		return KERROR_NOT_A_DIRECTORY;
+
+	char *p = d->volume->image.dirs + d->image.start;
+	char *end = p + d->image.size;
+	int total = 0;
+
+	while(p < end) {
+		struct imagefs_item *r = (struct imagefs_item *) p;
+		if(r->name_length + 1 > buffer_length)
+			break;
+		memcpy(buffer, r->name, r->name_length);
+		buffer[r->name_length] = 0;
+		buffer += r->name_length + 1;
+		buffer_length -= r->name_length + 1;
+		total += r->name_length + 1;
+		p += sizeof(*r) + r->name_length;
+	}
+
+	return total;
+}
+
+/* The readdir cookie is the byte offset of the next item in the directory. */
+
+static int imagefs_dirent_readdir(struct fs_dirent *d, char *buffer, int buffer_length, uint32_t *cookie)
+{
+	char *start = d->volume->image.dirs + d->image.start;
+	uint32_t offset = *cookie;
+	int total = 0;
+
+	while(offset < d->image.size) {
+		struct imagefs_item *r = (struct imagefs_item *) (start + offset);
+		if(r->inumber >= d->volume->image.super.inode_count)
+			break;
+
+		struct imagefs_inode *inode = &d->volume->image.inodes[r->inumber];
+
+		int used = fs_readdir_pack(buffer + total, buffer_length - total, r->name, r->name_length, inode->type == IMAGEFS_ITEM_DIR, r->inumber, inode->size);
+		if(!used) {
+			if(!total)
+				total = KERROR_INVALID_REQUEST;
+			break;
+		}
+		total += used;
+
+		offset += sizeof(*r) + r->name_length;
+	}
+
+	*cookie = offset;
+	return total;
+}
+
+static int imagefs_dirent_close(struct fs_dirent *d)
+{
+	return 0;
+}
+
+/* Load one of the metadata tables into kernel memory. */
+
+static void *imagefs_table_load(struct fs_volume *v, uint32_t length, uint32_t offset)
+{
+	char *table = kmalloc(length ? length : 1);
+	if(!table)
+		return 0;
+
+	if(imagefs_image_read(v, table, length, offset) < 0) {
+		kfree(table);
+		return 0;
+	}
+
+	return table;
+}
+
+static int imagefs_volume_close(struct fs_volume *v)
+{
+	imagefs_cache_purge(v);
+	if(v->image.extents)
+		kfree(v->image.extents);
+	if(v->image.inodes)
+		kfree(v->image.inodes);
+	if(v->image.dirs)
+		kfree(v->image.dirs);
+	return 0;
+}
+
+/* Return true if length bytes at offset lie within limit bytes. */
+
+static int imagefs_range_valid(uint32_t offset, uint32_t length, uint32_t limit)
+{
+	return offset <= limit && length <= limit - offset;
+}
+
+/*
+The image may come from any file, so check every offset in the
+tables once, before the lookup and read paths trust them.
+*/
+
+static int imagefs_volume_check(struct fs_volume *v)
+{
+	struct imagefs_superblock *sb = &v->image.super;
+	uint32_t bs = device_block_size(v->device);
+	uint32_t nblocks = device_nblocks(v->device);
+	uint32_t limit = nblocks > 0xffffffff / bs ? 0xffffffff : nblocks * bs;
+	uint32_t i;
+
+	for(i = 0; i < sb->extent_count; i++) {
+		struct imagefs_extent *e = &v->image.extents[i];
+		uint32_t clength = e->length & ~IMAGEFS_EXTENT_RAW;
+		if(clength > sb->block_size || !imagefs_range_valid(e->offset, clength, limit))
+			return 0;
+	}
+
+	for(i = 0; i < sb->inode_count; i++) {
+		struct imagefs_inode *n = &v->image.inodes[i];
+		if(n->type == IMAGEFS_ITEM_FILE) {
+			uint32_t blocks = n->size / sb->block_size + (n->size % sb->block_size ? 1 : 0);
+			if(!imagefs_range_valid(n->start, blocks, sb->extent_count))
+				return 0;
+		} else if(n->type == IMAGEFS_ITEM_DIR) {
+			if(!imagefs_range_valid(n->start, n->size, sb->dir_length))
+				return 0;
+			uint32_t offset = 0;
+			while(offset < n->size) {
+				struct imagefs_item *r = (struct imagefs_item *) (v->image.dirs + n->start + offset);
+				if(n->size - offset < sizeof(*r) || n->size - offset - sizeof(*r) < r->name_length)
+					return 0;
+				if(r->inumber >= sb->inode_count)
+					return 0;
+				offset += sizeof(*r) + r->name_length;
+			}
+		} else {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+extern struct fs image_fs;
+
+static struct fs_volume *imagefs_volume_open(struct device *device)
+{
+	if(!device)
+		return 0;
+
+	struct fs_volume *v = kmalloc(sizeof(*v));
+	if(!v)
+		return 0;
+
+	memset(v, 0, sizeof(*v));
+	v->fs = &image_fs;
+	v->device = device;
+	v->refcount = 1;
+
+	printf("imagefs: opening device %s unit %d\n", device_name(device), device_unit(device));
+
+	struct imagefs_superblock *sb = &v->image.super;
+
+	if(imagefs_image_read(v, (char *) sb, sizeof(*sb), 0) < 0 || sb->magic != IMAGEFS_MAGIC || sb->block_size == 0 || sb->block_size > PAGE_SIZE) {
+		printf("imagefs: no filesystem found!\n");
+		kfree(v);
+		return 0;
+	}
+
+	if(sb->extent_count > 0xffffffff / sizeof(struct imagefs_extent) || sb->inode_count > 0xffffffff / sizeof(struct imagefs_inode) || sb->inode_count == 0) {
+		printf("imagefs: superblock is corrupted\n");
+		kfree(v);
+		return 0;
+	}
+
+	v->block_size = sb->block_size;
+	v->image.extents = imagefs_table_load(v, sb->extent_count * sizeof(struct imagefs_extent), sb->extent_start);
+	v->image.inodes = imagefs_table_load(v, sb->inode_count * sizeof(struct imagefs_inode), sb->inode_start);
+	v->image.dirs = imagefs_table_load(v, sb->dir_length, sb->dir_start);
+
+	if(!v->image.extents || !v->image.inodes || !v->image.dirs) {
+		printf("imagefs: couldn't load metadata tables\n");
+		imagefs_volume_close(v);
+		kfree(v);
+		return 0;
+	}
+
+	if(!imagefs_volume_check(v)) {
+		printf("imagefs: metadata tables are corrupted\n");
+		imagefs_volume_close(v);
+		kfree(v);
+		return 0;
+	}
+
+	printf("imagefs: %d inodes, %d blocks\n", sb->inode_count, sb->extent_count);
+
+	return v;
+}
+
+static struct fs_dirent *imagefs_volume_root(struct fs_volume *v)
+{
+	return imagefs_dirent_create(v, 0);
+}
+
+const static struct fs_ops imagefs_ops = {
+	.volume_open = imagefs_volume_open,
+	.volume_close = imagefs_volume_close,
+	.volume_root = imagefs_volume_root,
+
+	.lookup = imagefs_dirent_lookup,
+	.mkdir = 0,
+	.mkfile = 0,
+	.read_block = imagefs_dirent_read_block,
+	.write_block = 0,
+	.list = imagefs_dirent_list,
+	.readdir = imagefs_dirent_readdir,
+	.remove = 0,
+	.resize = 0,
+	.close = imagefs_dirent_close,
+};
+
+struct fs image_fs = {
+	"imagefs",
+	&imagefs_ops,
+	0
+};
+
+int imagefs_init()
+{
+	fs_register(&image_fs);
+	return 0;
+}
@@ -0,0 +1,81 @@
+/*
+Copyright (C) 2016-2019 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file LICENSE for details.
+*/
+
+#ifndef IMAGEFS_H
+#define IMAGEFS_H
+
+#include "kernel/types.h"
+
+/*
+imagefs is a compact, read-only filesystem image built on the host
+by tools/mkimagefs.  File data is cut into blocks of IMAGEFS_BLOCK_SIZE
+bytes, and each block is compressed with LZ4 independently, so that
+any block can be read without touching its neighbors.  The image
+is laid out as follows, with all offsets measured in bytes:
+
+superblock | extent table | inode table | directory table | data
+
+The extent table has one entry per data block, giving the location
+and compressed length of that block.  An inode describes a file
+as a run of consecutive extents, or a directory as a range of the
+directory table.  The inode, directory, and extent tables are small,
+and are loaded into memory entirely when the volume is opened.
+*/
+
+#define IMAGEFS_MAGIC 0x5a494d47
+#define IMAGEFS_BLOCK_SIZE 4096
+
+#define IMAGEFS_ITEM_FILE 1
+#define IMAGEFS_ITEM_DIR 2
+
+/* If set in an extent length, the block is stored uncompressed. */
+#define IMAGEFS_EXTENT_RAW 0x80000000
+
+struct imagefs_superblock {
+	uint32_t magic;
+	uint32_t block_size;
+	uint32_t extent_start;
+	uint32_t extent_count;
+	uint32_t inode_start;
+	uint32_t inode_count;
+	uint32_t dir_start;
+	uint32_t dir_length;
+};
+
+struct imagefs_extent {
+	uint32_t offset;
+	uint32_t length;
+};
+
+struct imagefs_inode {
+	uint32_t type;
+	uint32_t size;	// bytes of file data, or bytes of directory items
+	uint32_t start;	// first extent of a file, or offset into the directory table
+};
+
+/*
+Directory items are packed back to back, and the name
+is not null terminated.  Every directory begins with "." and "..".
+*/
+
+#pragma pack(1)
+struct imagefs_item {
+	uint32_t inumber;
+	uint8_t name_length;
+	char name[];
+};
+#pragma pack()
+
+struct imagefs_volume {
+	struct imagefs_superblock super;
+	struct imagefs_extent *extents;
+	struct imagefs_inode *inodes;
+	char *dirs;
+};
+
+int imagefs_init();
+
+#endif
@@ -0,0 +1,146 @@
+/*
+Copyright (C) 2016-2019 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file LICENSE for details.
+*/
+
+#include "kernel/types.h"
+#include "kernel/error.h"
+#include "initramfs.h"
+#include "fs.h"
+#include "device.h"
+#include "loop.h"
+#include "tmpfs.h"
+#include "clock.h"
+#include "process.h"
+#include "printf.h"
+
+/* Search each atapi unit for a cdrom holding the boot archive. */
+
+static struct fs_dirent *initramfs_find_archive()
+{
+	struct fs *cdromfs = fs_lookup("cdromfs");
+	int unit;
+
+	if(!cdromfs)
+		return 0;
+
+	for(unit = 0; unit < INITRAMFS_MAX_UNITS; unit++) {
+		struct device *dev = device_open("atapi", unit);
+		if(!dev)
+			continue;
+
+		struct fs_volume *v = fs_volume_open(cdromfs, dev);
+		device_close(dev);
+		if(!v)
+			continue;
+
+		struct fs_dirent *root = fs_volume_root(v);
+		fs_volume_close(v);
+		if(!root)
+			continue;
+
+		struct fs_dirent *d = fs_dirent_traverse(root, INITRAMFS_PATH);
+		fs_dirent_close(root);
+		if(d) {
+			printf("initramfs: found /%s on atapi unit %d\n", INITRAMFS_PATH, unit);
+			return d;
+		}
+	}
+
+	return 0;
+}
+
+/* Open the archive file as an imagefs volume, by way of a loop device. */
+
+static struct fs_dirent *initramfs_open_archive(int unit)
+{
+	struct fs *imagefs = fs_lookup("imagefs");
+	if(!imagefs)
+		return 0;
+
+	struct device *dev = device_open("loop", unit);
+	if(!dev)
+		return 0;
+
+	struct fs_volume *v = fs_volume_open(imagefs, dev);
+	device_close(dev);
+	if(!v)
+		return 0;
+
+	struct fs_dirent *root = fs_volume_root(v);
+	fs_volume_close(v);
+	return root;
+}
+
+static struct fs_dirent *initramfs_create_root()
+{
+	struct fs *tmpfs = fs_lookup("tmpfs");
+	if(!tmpfs)
+		return 0;
+
+	struct fs_volume *v = fs_volume_open(tmpfs, 0);
+	if(!v)
+		return 0;
+
+	struct fs_dirent *root = fs_volume_root(v);
+	fs_volume_close(v);
+	return root;
+}
+
+int initramfs_init()
+{
+	clock_t start = clock_read();
+
+	struct fs_dirent *archive = initramfs_find_archive();
+	if(!archive) {
+		printf("initramfs: no boot archive found\n");
+		return KERROR_NOT_FOUND;
+	}
+
+	int unit = loop_attach(archive, 0);
+	fs_dirent_close(archive);
+	if(unit < 0) {
+		printf("initramfs: couldn't attach boot archive to a loop device\n");
+		return unit;
+	}
+
+	struct fs_dirent *src = initramfs_open_archive(unit);
+	if(!src) {
+		printf("initramfs: couldn't open boot archive\n");
+		loop_detach(unit);
+		return KERROR_NOT_FOUND;
+	}
+
+	struct fs_dirent *dst = initramfs_create_root();
+	if(!dst) {
+		printf("initramfs: couldn't create root filesystem\n");
+		fs_dirent_close(src);
+		loop_detach(unit);
+		return KERROR_OUT_OF_MEMORY;
+	}
+
+	int result = fs_dirent_copy(src, dst, 0);
+
+	// Closing the last dirent closes the volume and the loop device.
+	fs_dirent_close(src);
+	loop_detach(unit);
+
+	if(result < 0) {
+		printf("initramfs: couldn't unpack boot archive\n");
+		fs_dirent_close(dst);
+		return result;
+	}
+
+	current->root_dir = dst;
+	current->current_dir = fs_dirent_addref(dst);
+
+	struct tmpfs_stats stats;
+	tmpfs_get_stats(&stats);
+
+	clock_t elapsed = clock_diff(start, clock_read());
+	printf("initramfs: unpacked %d pages into root in %d.%03d seconds\n",
+		stats.pages_used, elapsed.seconds, elapsed.millis);
+
+	return 0;
+}
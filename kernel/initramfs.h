@@ -0,0 +1,21 @@
+/*
+Copyright (C) 2016-2019 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file LICENSE for details.
+*/
+
+#ifndef INITRAMFS_H
+#define INITRAMFS_H
+
+/*
+At boot, the compressed imagefs archive on the cdrom is unpacked
+into a tmpfs volume, which becomes the root directory.  The cdrom
+is read once here, and programs are then loaded from memory.
+*/
+
+#define INITRAMFS_PATH "boot/image.img"
+#define INITRAMFS_MAX_UNITS 4
+
+int initramfs_init();
+
+#endif
@@ -10,6 +10,7 @@ See the file LICENSE for details.
 #include "process.h"
 #include "kernelcore.h"
 #include "x86.h"
+#include "mmap.h"
 
 static interrupt_handler_t interrupt_handler_table[48];
 static uint32_t interrupt_count[48];
@@ -38,34 +39,35 @@ static const char *exception_names[] = {
 static void unknown_exception(int i, int code)
 {
 	unsigned vaddr; // virtual address trying to be accessed
-	unsigned paddr; // physical address
 	unsigned esp; // stack pointer
 
 	if(i==14) {
 		asm("mov %%cr2, %0" : "=r" (vaddr) ); // virtual address trying to be accessed		
-		esp  = ((struct x86_stack *)(current->kstack_top - sizeof(struct x86_stack)))->esp; // stack pointer of the process that raised the exception
-		// Check if the requested memory is in the stack or data
-		int data_access = vaddr < current->vm_data_size;
-
-		// Subtract 128 from esp because of the red-zone 
-		// According to https:gcc.gnu.org, the red zone is a 128-byte area beyond 
-		// the stack pointer that will not be modified by signal or interrupt handlers 
-		// and therefore can be used for temporary data without adjusting the stack pointer.
-		int stack_access = vaddr >= esp - 128; 
-
-		// Check if the requested memory is already in use
-		int page_already_present = pagetable_getmap(current->pagetable,vaddr,&paddr,0);
-		
-		// Check if page is already mapped (which will result from violating the permissions on page) or that
-		// we are accessing neither the stack nor the heap, or we are accessing both. If so, error
-		if (page_already_present || !(data_access ^ stack_access)) {
+
+		// A write to a page shared since fork takes a private copy of it.
+		if((code & 2) && current && pagetable_cow_fault(current->pagetable, vaddr))
+			return;
+
+		// Faults within a mapped file are resolved from the page cache.
+		int mapped = current ? mmap_fault(current, vaddr, code & 2) : 0;
+		if(mapped > 0) {
+			return;
+		} else if(mapped < 0) {
+			printf("interrupt: illegal access to mapped file at vaddr %x\n",vaddr);
+			process_dump(current);
+			process_exit(0);
+		}
+
+		if(current) {
+			esp  = ((struct x86_stack *)(current->kstack_top - sizeof(struct x86_stack)))->esp; // stack pointer of the process that raised the exception
+
+			// Heap and stack pages are mapped on first touch.
+			if(process_memory_fault(current, vaddr, esp))
+				return;
+
 			printf("interrupt: illegal page access at vaddr %x\n",vaddr);
 			process_dump(current);
 			process_exit(0);
-		} else {
-			// XXX update process->vm_stack_size when growing the stack.
-			pagetable_alloc(current->pagetable, vaddr, PAGE_SIZE, PAGE_FLAG_USER | PAGE_FLAG_READWRITE | PAGE_FLAG_CLEAR);
-			return;
 		}
 	} else {
 		printf("interrupt: exception %d: %s (code %x)\n", i, exception_names[i], code);
@@ -0,0 +1,89 @@
+/*
+Copyright (C) 2016-2019 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file LICENSE for details.
+*/
+
+#include "io_ring.h"
+#include "kobject.h"
+#include "process.h"
+#include "is_valid.h"
+#include "kernel/error.h"
+
+/*
+The drivers are polled, and there are no kernel threads to carry
+requests in the background, so requests are carried out in order
+while the process is in io_ring_enter.  The gain is that any number
+of operations on any number of objects cost a single kernel entry.
+*/
+
+static int io_ring_execute(const struct io_request *r)
+{
+	if(!is_valid_object(r->fd))
+		return KERROR_INVALID_OBJECT;
+
+	struct kobject *k = current->ktable[r->fd];
+
+	switch (r->opcode) {
+	case IO_OP_NOP:
+		return 0;
+	case IO_OP_READ:
+		if(!is_valid_pointer(r->data, r->length))
+			return KERROR_INVALID_ADDRESS;
+		if(r->offset < 0)
+			return kobject_read(k, r->data, r->length);
+		return kobject_pread(k, r->data, r->length, r->offset);
+	case IO_OP_WRITE:
+		if(!is_valid_pointer(r->data, r->length))
+			return KERROR_INVALID_ADDRESS;
+		if(r->offset < 0)
+			return kobject_write(k, r->data, r->length);
+		return kobject_pwrite(k, r->data, r->length, r->offset);
+	case IO_OP_FSYNC:
+		return kobject_sync(k, 0);
+	case IO_OP_FDATASYNC:
+		return kobject_sync(k, 1);
+	case IO_OP_TRANSFER:
+		if(!is_valid_object(r->fd2))
+			return KERROR_INVALID_OBJECT;
+		return kobject_transfer(k, current->ktable[r->fd2], r->length);
+	default:
+		return KERROR_INVALID_REQUEST;
+	}
+}
+
+/*
+Take up to to_submit requests from the submission queue, and keep
+going past that until at least min_complete completions are waiting.
+Stops early if the submission queue is empty or the completion queue
+is full.  Returns the number of requests taken.
+*/
+
+int io_ring_enter(struct io_ring *ring, int to_submit, int min_complete)
+{
+	int submitted = 0;
+
+	while(ring->sq_head != ring->sq_tail) {
+		uint32_t waiting = ring->cq_tail - ring->cq_head;
+
+		if(submitted >= to_submit && waiting >= min_complete)
+			break;
+		if(waiting >= IO_RING_SIZE)
+			break;
+
+		// Copy the request, since the process may change the ring at any time.
+		struct io_request r = ring->sq[ring->sq_head % IO_RING_SIZE];
+		ring->sq_head++;
+
+		int result = io_ring_execute(&r);
+
+		struct io_completion *c = &ring->cq[ring->cq_tail % IO_RING_SIZE];
+		c->user_data = r.user_data;
+		c->result = result;
+		ring->cq_tail++;
+
+		submitted++;
+	}
+
+	return submitted;
+}
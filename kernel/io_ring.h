@@ -0,0 +1,14 @@
+/*
+Copyright (C) 2016-2019 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file LICENSE for details.
+*/
+
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include "kernel/io_ring.h"
+
+int io_ring_enter(struct io_ring *ring, int to_submit, int min_complete);
+
+#endif
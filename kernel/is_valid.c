@@ -97,6 +97,20 @@ int is_valid_pointer( void *ptr, int length )
 	return 1;
 }
 
+// Return true if iov is an array of count iovecs, each a valid area in user space.
+
+int is_valid_iovec( const struct iovec *iov, int count )
+{
+	int i;
+	if(count<0 || count>KERNEL_IOV_MAX) return 0;
+	if(!is_valid_pointer((void*)iov,count*sizeof(*iov))) return 0;
+	for(i=0;i<count;i++) {
+		if(iov[i].length<0) return 0;
+		if(!is_valid_pointer(iov[i].base,iov[i].length)) return 0;
+	}
+	return 1;
+}
+
 // Return true if string points to a valid area in user space.
 // XXX Needs to be implemented!
 
@@ -28,6 +28,9 @@ int is_valid_object_type( int fd, kobject_type_t type );
 // Return true if (ptr,length) describes a valid area in user space.
 int is_valid_pointer( void *ptr, int length );
 
+// Return true if iov is an array of count iovecs, each a valid area in user space.
+int is_valid_iovec( const struct iovec *iov, int count );
+
 // Return true if string points to a valid area in user space.
 int is_valid_string( const char *str );
 
@@ -6,204 +6,614 @@ See the file LICENSE for details.
 
 #include "kmalloc.h"
 #include "console.h"
+#include "string.h"
+#include "clock.h"
 #include "kernel/types.h"
 #include "memorylayout.h"
+#include "vmalloc.h"
 
-#define KUNIT sizeof(struct kmalloc_chunk)
+/*
+kmalloc is a two level segregated fit allocator (TLSF).
+Free chunks are kept in lists by size class: the first level
+is the power of two of the size, and the second level divides
+each power of two into KMALLOC_SL_COUNT equal ranges.  A bitmap
+at each level records which lists are non-empty, so that a fitting
+chunk is found with two bit scans instead of a walk over the heap.
+
+Each chunk records its length and the physically preceding chunk
+(a boundary tag), so that kfree can merge a chunk with both of its
+neighbours in constant time.  The end of the heap is marked by a
+sentinel chunk that is never free.
+
+The heap starts out as the fixed kmalloc area.  When that is full,
+kmalloc adds another arena of at least KMALLOC_GROW_LENGTH bytes
+from vmalloc, and an added arena that becomes entirely free again
+is given back.
+*/
+
+#define KUNIT 16
 
 #define KMALLOC_STATE_FREE 0xa1a1a1a1
 #define KMALLOC_STATE_USED 0xbfbfbfbf
+#define KMALLOC_STATE_END  0xe5e5e5e5
+
+#define KMALLOC_SL_BITS 4
+#define KMALLOC_SL_COUNT (1<<KMALLOC_SL_BITS)
+#define KMALLOC_FL_COUNT 32
+
+/* The smallest chunk must hold the header and the free list links. */
+#define KMALLOC_MIN_CHUNK (2*KUNIT)
+#define KMALLOC_MAX_LENGTH (1<<30)
+
+#define KMALLOC_MAX_ARENAS 32
+#define KMALLOC_GROW_LENGTH (256*1024)
+
+/*
+The first KUNIT bytes are the header of every chunk.
+The free list links overlap the data of a chunk in use.
+*/
 
 struct kmalloc_chunk {
 	int state;
 	int length;
-	struct kmalloc_chunk *next;
 	struct kmalloc_chunk *prev;
+	int reserved;
+	struct kmalloc_chunk *next_free;
+	struct kmalloc_chunk *prev_free;
+};
+
+struct kmalloc_heap {
+	uint32_t fl_bitmap;
+	uint32_t sl_bitmap[KMALLOC_FL_COUNT];
+	struct kmalloc_chunk *free[KMALLOC_FL_COUNT][KMALLOC_SL_COUNT];
+	struct kmalloc_chunk *arena[KMALLOC_MAX_ARENAS];
+	int arenas;
+	int total;
+	int used;
 };
 
-static struct kmalloc_chunk *head = 0;
+static struct kmalloc_heap kernel_heap;
+
+#define CHUNK_NEXT(c) ((struct kmalloc_chunk *) ((char *) (c) + (c)->length))
+
+static int bit_first(uint32_t x)
+{
+	return __builtin_ctz(x);
+}
+
+static int bit_last(uint32_t x)
+{
+	return 31 - __builtin_clz(x);
+}
+
+/* Find the list that holds chunks of exactly this length. */
+
+static void kmapping(int length, int *fl, int *sl)
+{
+	*fl = bit_last(length);
+	*sl = (length >> (*fl - KMALLOC_SL_BITS)) ^ KMALLOC_SL_COUNT;
+}
+
+static void kinsert(struct kmalloc_heap *h, struct kmalloc_chunk *c)
+{
+	int fl, sl;
+	kmapping(c->length, &fl, &sl);
+
+	c->state = KMALLOC_STATE_FREE;
+	c->prev_free = 0;
+	c->next_free = h->free[fl][sl];
+	if(c->next_free)
+		c->next_free->prev_free = c;
+	h->free[fl][sl] = c;
+
+	h->fl_bitmap |= (1 << fl);
+	h->sl_bitmap[fl] |= (1 << sl);
+}
+
+static void kremove(struct kmalloc_heap *h, struct kmalloc_chunk *c)
+{
+	int fl, sl;
+	kmapping(c->length, &fl, &sl);
+
+	if(c->next_free)
+		c->next_free->prev_free = c->prev_free;
+	if(c->prev_free) {
+		c->prev_free->next_free = c->next_free;
+	} else {
+		h->free[fl][sl] = c->next_free;
+		if(!h->free[fl][sl]) {
+			h->sl_bitmap[fl] &= ~(1 << sl);
+			if(!h->sl_bitmap[fl])
+				h->fl_bitmap &= ~(1 << fl);
+		}
+	}
+}
 
 /*
-Initialize the linked list by creating a single chunk at
-a given start address and length.  The chunk is initially
-free and has no next or previous chunks.
+Find a free chunk of at least length bytes.  The length is first
+rounded up to the next size class, so that any chunk in the list
+found is big enough, and the search never walks a list.
 */
 
-void kmalloc_init(char *start, int length)
+static struct kmalloc_chunk *kfind(struct kmalloc_heap *h, int length)
 {
-	head = (struct kmalloc_chunk *) start;
-	head->state = KMALLOC_STATE_FREE;
-	head->length = length;
-	head->next = 0;
-	head->prev = 0;
+	int fl, sl;
+	uint32_t map;
+
+	length += (1 << (bit_last(length) - KMALLOC_SL_BITS)) - 1;
+	kmapping(length, &fl, &sl);
+
+	map = h->sl_bitmap[fl] & (~0u << sl);
+	if(!map) {
+		map = fl + 1 < KMALLOC_FL_COUNT ? h->fl_bitmap & (~0u << (fl + 1)) : 0;
+		if(!map)
+			return 0;
+		fl = bit_first(map);
+		map = h->sl_bitmap[fl];
+	}
+	sl = bit_first(map);
+
+	return h->free[fl][sl];
 }
 
 /*
-Split a large chunk into two, such that the current chunk
-has the desired length, and the next chunk has the remainder.
+Add a region of memory to the heap as a new arena, made of a
+single free chunk followed by the sentinel at the very end.
 */
 
-static void ksplit(struct kmalloc_chunk *c, int length)
+static int kheap_add(struct kmalloc_heap *h, char *start, int length)
 {
-	struct kmalloc_chunk *n = (struct kmalloc_chunk *) ((char *) c + length);
+	char *aligned = (char *) (((uint32_t) start + KUNIT - 1) & ~(KUNIT - 1));
+	length = (length - (aligned - start)) & ~(KUNIT - 1);
+
+	if(h->arenas >= KMALLOC_MAX_ARENAS || length < KMALLOC_MIN_CHUNK + KUNIT)
+		return 0;
+
+	struct kmalloc_chunk *c = (struct kmalloc_chunk *) aligned;
+	c->length = length - KUNIT;
+	c->prev = 0;
 
-	n->state = KMALLOC_STATE_FREE;
-	n->length = c->length - length;
-	n->prev = c;
-	n->next = c->next;
+	struct kmalloc_chunk *end = CHUNK_NEXT(c);
+	end->state = KMALLOC_STATE_END;
+	end->length = KUNIT;
+	end->prev = c;
 
-	if(c->next)
-		c->next->prev = n;
+	kinsert(h, c);
+	h->arena[h->arenas++] = c;
+	h->total += c->length;
 
-	c->next = n;
-	c->length = length;
+	return 1;
+}
+
+static void kheap_init(struct kmalloc_heap *h, char *start, int length)
+{
+	memset(h, 0, sizeof(*h));
+	kheap_add(h, start, length);
+}
+
+/*
+Remove arena n, which must consist of a single free chunk,
+returning the start of its memory.
+*/
+
+static void *kheap_remove(struct kmalloc_heap *h, int n)
+{
+	struct kmalloc_chunk *c = h->arena[n];
+
+	kremove(h, c);
+	h->total -= c->length;
+	h->arena[n] = h->arena[--h->arenas];
+
+	return c;
 }
 
 /*
 Allocate a chunk of memory of the given length.
-To avoid fragmentation, round up the length to
-a multiple of the chunk size.  Then, search fo
-a chunk of the desired size, and split it if necessary.
+Round up the length to a multiple of the chunk unit,
+add one unit for the header, then take the chunk from
+the first fitting size class, and split off the remainder.
 */
 
-void *kmalloc(int length)
+static void *kheap_alloc(struct kmalloc_heap *h, int length)
 {
-	// round up length to a multiple of KUNIT
-	int extra = length % KUNIT;
-	if(extra)
-		length += (KUNIT - extra);
+	if(length < 0 || length > KMALLOC_MAX_LENGTH)
+		return 0;
 
-	// then add one more unit to accommodate the chunk header
-	length += KUNIT;
+	length = ((length + KUNIT - 1) & ~(KUNIT - 1)) + KUNIT;
+	if(length < KMALLOC_MIN_CHUNK)
+		length = KMALLOC_MIN_CHUNK;
 
-	struct kmalloc_chunk *c = head;
+	struct kmalloc_chunk *c = kfind(h, length);
+	if(!c)
+		return 0;
 
-	while(1) {
-		if(!c) {
-			printf("kmalloc: out of memory!\n");
-			return 0;
-		}
-		if(c->state == KMALLOC_STATE_FREE && c->length >= length)
-			break;
-		c = c->next;
-	}
+	kremove(h, c);
 
-	// split the chunk if the remainder is greater than two units
-	if(length - c->length > 2 * KUNIT) {
-		ksplit(c, length);
+	if(c->length - length >= KMALLOC_MIN_CHUNK) {
+		struct kmalloc_chunk *n = (struct kmalloc_chunk *) ((char *) c + length);
+		n->length = c->length - length;
+		n->prev = c;
+		CHUNK_NEXT(n)->prev = n;
+		c->length = length;
+		kinsert(h, n);
 	}
 
 	c->state = KMALLOC_STATE_USED;
+	h->used += c->length;
 
 	// return a pointer to the memory following the chunk header
-	return (c + 1);
+	return (char *) c + KUNIT;
 }
 
 /*
-Attempt to merge a chunk with its successor,
-if it exists and both are in the free state.
+Free memory by marking the chunk as de-allocated,
+then merging it with its successor and predecessor
+if they are free, before returning it to its list.
 */
 
-static void kmerge(struct kmalloc_chunk *c)
+static struct kmalloc_chunk *kheap_free(struct kmalloc_heap *h, void *ptr)
 {
-	if(!c)
-		return;
+	struct kmalloc_chunk *c = (struct kmalloc_chunk *) ((char *) ptr - KUNIT);
 
-	if(c->state != KMALLOC_STATE_FREE)
-		return;
+	if(c->state != KMALLOC_STATE_USED)
+		return 0;
 
-	if(c->next && c->next->state == KMALLOC_STATE_FREE) {
-		c->length += c->next->length;
-		if(c->next->next) {
-			c->next->next->prev = c;
-		}
-		c->next = c->next->next;
+	c->state = KMALLOC_STATE_FREE;
+	h->used -= c->length;
+
+	struct kmalloc_chunk *n = CHUNK_NEXT(c);
+	if(n->state == KMALLOC_STATE_FREE) {
+		kremove(h, n);
+		c->length += n->length;
+		CHUNK_NEXT(c)->prev = c;
+	}
+
+	struct kmalloc_chunk *p = c->prev;
+	if(p && p->state == KMALLOC_STATE_FREE) {
+		kremove(h, p);
+		p->length += c->length;
+		CHUNK_NEXT(p)->prev = p;
+		c = p;
 	}
 
+	kinsert(h, c);
+	return c;
+}
+
+void kmalloc_init(char *start, int length)
+{
+	kheap_init(&kernel_heap, start, length);
 }
 
 /*
-Free memory by marking the chunk as de-allocated,
-then attempting to merge it with the predecessor and successor.
+Grow the kernel heap by enough to satisfy an allocation of length:
+allowing for the headers, and for kfind rounding up to a size class.
 */
 
+static int kmalloc_grow(int length)
+{
+	int grow = length + length / KMALLOC_SL_COUNT + 4 * KUNIT;
+	grow = MAX(grow, KMALLOC_GROW_LENGTH);
+	grow = (grow + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+	char *region = vmalloc(grow);
+	if(!region)
+		return 0;
+
+	if(!kheap_add(&kernel_heap, region, grow)) {
+		vfree(region);
+		return 0;
+	}
+
+	return 1;
+}
+
+void *kmalloc(int length)
+{
+	void *ptr = kheap_alloc(&kernel_heap, length);
+	if(!ptr && length >= 0 && length <= KMALLOC_MAX_LENGTH && kmalloc_grow(length))
+		ptr = kheap_alloc(&kernel_heap, length);
+	if(!ptr)
+		printf("kmalloc: out of memory!\n");
+	return ptr;
+}
+
 void kfree(void *ptr)
 {
-	struct kmalloc_chunk *c = (struct kmalloc_chunk *) ptr;
-	c--;
+	struct kmalloc_chunk *c = kheap_free(&kernel_heap, ptr);
+	int i;
 
-	if(c->state != KMALLOC_STATE_USED) {
+	if(!c) {
 		printf("invalid kfree(%x)\n", ptr);
 		return;
 	}
 
-	c->state = KMALLOC_STATE_FREE;
-
-	kmerge(c);
-	kmerge(c->prev);
+	// Give back an added arena once it is entirely free.
+	if(c->prev == 0 && CHUNK_NEXT(c)->state == KMALLOC_STATE_END) {
+		for(i = 1; i < kernel_heap.arenas; i++) {
+			if(kernel_heap.arena[i] == c) {
+				vfree(kheap_remove(&kernel_heap, i));
+				break;
+			}
+		}
+	}
 }
 
-void kmalloc_debug()
+static void kheap_debug(struct kmalloc_heap *h)
 {
 	struct kmalloc_chunk *c;
+	int i;
 
 	printf("state ptr      prev     next     length\n");
 
-	for(c = head; c; c = c->next) {
-		if(c->state == KMALLOC_STATE_FREE) {
-			printf("F");
-		} else if(c->state == KMALLOC_STATE_USED) {
-			printf("U");
-		} else {
-			printf("kmalloc list corrupted at %x!\n", c);
-			return;
+	for(i = 0; i < h->arenas; i++) {
+		for(c = h->arena[i]; c->state != KMALLOC_STATE_END; c = CHUNK_NEXT(c)) {
+			if(c->state == KMALLOC_STATE_FREE) {
+				printf("F");
+			} else if(c->state == KMALLOC_STATE_USED) {
+				printf("U");
+			} else {
+				printf("kmalloc list corrupted at %x!\n", c);
+				return;
+			}
+			printf("     %x %x %x %d\n", c, c->prev, CHUNK_NEXT(c), c->length);
 		}
-		printf("     %x %x %x %d\n", c, c->prev, c->next, c->length);
 	}
+
+	printf("%d of %d bytes used\n", h->used, h->total);
+}
+
+void kmalloc_debug()
+{
+	kheap_debug(&kernel_heap);
 }
 
 // Testing
 
+/*
+The tests run on a private heap carved out of the kernel heap,
+so that they can check its exact layout without disturbing
+any allocation in use, and can be run at any time.
+*/
+
+#define TEST_HEAP_LENGTH (128*1024)
+#define TEST_SLOTS 256
+#define TEST_OPERATIONS 50000
+
+static struct kmalloc_heap test_heap;
+static char *test_region = 0;
+static uint32_t test_random = 1;
+
+static int test_rand(void)
+{
+	test_random = test_random * 1103515245 + 12345;
+	return (test_random >> 16) & 0x7fff;
+}
+
 static void setup(void)
 {
-	kmalloc_init((char *) KMALLOC_START, KMALLOC_LENGTH);
+	kheap_init(&test_heap, test_region, TEST_HEAP_LENGTH);
+	test_random = 1;
 }
 
 static void tear_down(void)
 {
 }
 
+/*
+Check every chunk against its neighbours and the free lists,
+returning the largest free chunk, or -1 if the heap is inconsistent.
+*/
+
+static int kheap_check(struct kmalloc_heap *h)
+{
+	struct kmalloc_chunk *c, *prev;
+	int used = 0, largest = 0;
+	int i;
+
+	for(i = 0; i < h->arenas; i++) {
+		prev = 0;
+		for(c = h->arena[i]; c->state != KMALLOC_STATE_END; c = CHUNK_NEXT(c)) {
+			if(c->prev != prev || c->length < KMALLOC_MIN_CHUNK || c->length % KUNIT)
+				return -1;
+			if(c->state == KMALLOC_STATE_FREE) {
+				int fl, sl;
+				if(prev && prev->state == KMALLOC_STATE_FREE)
+					return -1;
+				kmapping(c->length, &fl, &sl);
+				if(!(h->sl_bitmap[fl] & (1 << sl)))
+					return -1;
+				largest = MAX(largest, c->length);
+			} else if(c->state == KMALLOC_STATE_USED) {
+				used += c->length;
+			} else {
+				return -1;
+			}
+			prev = c;
+		}
+		if(c->prev != prev)
+			return -1;
+	}
+
+	if(used != h->used)
+		return -1;
+
+	return largest;
+}
+
 static int kmalloc_test_single_alloc(void)
 {
-	char *ptr = kmalloc(128);
+	char *ptr = kheap_alloc(&test_heap, 128);
+	struct kmalloc_chunk *head = test_heap.arena[0];
 	struct kmalloc_chunk *next = 0;
-	int res = (unsigned long) ptr == (unsigned long) head + sizeof(struct kmalloc_chunk);
+	int res = (unsigned long) ptr == (unsigned long) head + KUNIT;
 	res &= head->state == KMALLOC_STATE_USED;
-	res &= head->length == 128 + sizeof(struct kmalloc_chunk);
-	res &= (char *) head->next == (char *) KMALLOC_START + head->length;
-	next = head->next;
+	res &= head->length == 128 + KUNIT;
+	next = CHUNK_NEXT(head);
 	res &= next->state == KMALLOC_STATE_FREE;
-	res &= next->length == KMALLOC_LENGTH - head->length;
+	res &= next->prev == head;
+	res &= next->length == test_heap.total - head->length;
 
 	return res;
 }
 
 static int kmalloc_test_single_alloc_and_free(void)
 {
-	char *ptr = kmalloc(128);
+	char *ptr = kheap_alloc(&test_heap, 128);
+	struct kmalloc_chunk *head = test_heap.arena[0];
 	int res;
-	kfree(ptr);
+	kheap_free(&test_heap, ptr);
 	res = head->state == KMALLOC_STATE_FREE;
-	res &= head->next == 0;
-	res &= head->length == KMALLOC_LENGTH;
+	res &= CHUNK_NEXT(head)->state == KMALLOC_STATE_END;
+	res &= head->length == test_heap.total;
 
 	return res;
 }
 
+static int kmalloc_test_merge(void)
+{
+	char *a = kheap_alloc(&test_heap, 100);
+	char *b = kheap_alloc(&test_heap, 200);
+	char *c = kheap_alloc(&test_heap, 300);
+	char *d = kheap_alloc(&test_heap, 400);
+	int res;
+
+	kheap_free(&test_heap, a);
+	kheap_free(&test_heap, c);
+	res = kheap_check(&test_heap) >= 0;
+
+	// b merges with both a and c
+	kheap_free(&test_heap, b);
+	res &= test_heap.arena[0]->state == KMALLOC_STATE_FREE;
+	res &= CHUNK_NEXT(test_heap.arena[0]) == (struct kmalloc_chunk *) (d - KUNIT);
+
+	kheap_free(&test_heap, d);
+	res &= test_heap.arena[0]->length == test_heap.total;
+	res &= kheap_check(&test_heap) == test_heap.total;
+
+	return res;
+}
+
+/*
+Split the test region into two arenas, and check that two
+allocations too big to share one are placed in both.
+*/
+
+static int kmalloc_test_arenas(void)
+{
+	int half = TEST_HEAP_LENGTH / 2;
+	int res;
+
+	kheap_init(&test_heap, test_region, half);
+	res = kheap_add(&test_heap, test_region + half, half);
+
+	char *a = kheap_alloc(&test_heap, half / 2);
+	char *b = kheap_alloc(&test_heap, half / 2 + KUNIT);
+	res &= a && b;
+	res &= (a < test_region + half) != (b < test_region + half);
+	res &= kheap_check(&test_heap) >= 0;
+
+	kheap_free(&test_heap, a);
+	kheap_free(&test_heap, b);
+	res &= test_heap.arena[0]->length + test_heap.arena[1]->length == test_heap.total;
+	res &= kheap_check(&test_heap) == test_heap.arena[0]->length;
+
+	return res;
+}
+
+/*
+Allocate and free blocks of random sizes in random order,
+filling each with a pattern that is checked when it is freed.
+At the end, everything must merge back into a single chunk.
+*/
+
+static int kmalloc_test_stress(void)
+{
+	char *slot[TEST_SLOTS];
+	int length[TEST_SLOTS];
+	int i, j;
+
+	memset(slot, 0, sizeof(slot));
+
+	for(i = 0; i < TEST_OPERATIONS; i++) {
+		int n = test_rand() % TEST_SLOTS;
+		if(slot[n]) {
+			for(j = 0; j < length[n]; j++) {
+				if(slot[n][j] != (char) n)
+					return 0;
+			}
+			kheap_free(&test_heap, slot[n]);
+			slot[n] = 0;
+		} else {
+			length[n] = 1 + test_rand() % 1024;
+			slot[n] = kheap_alloc(&test_heap, length[n]);
+			if(slot[n])
+				memset(slot[n], n, length[n]);
+		}
+		if(i % 1000 == 0 && kheap_check(&test_heap) < 0)
+			return 0;
+	}
+
+	for(i = 0; i < TEST_SLOTS; i++) {
+		if(slot[i])
+			kheap_free(&test_heap, slot[i]);
+	}
+
+	return kheap_check(&test_heap) == test_heap.total;
+}
+
+/*
+Time a steady mix of allocations and frees of random sizes,
+and report how fragmented the heap is at the end of it:
+the largest free chunk as a fraction of all free space.
+*/
+
+static int kmalloc_test_timing(void)
+{
+	char *slot[TEST_SLOTS];
+	int i;
+
+	memset(slot, 0, sizeof(slot));
+
+	clock_t start = clock_read();
+
+	for(i = 0; i < TEST_OPERATIONS; i++) {
+		int n = test_rand() % TEST_SLOTS;
+		if(slot[n]) {
+			kheap_free(&test_heap, slot[n]);
+			slot[n] = 0;
+		} else {
+			slot[n] = kheap_alloc(&test_heap, 1 + test_rand() % 1024);
+		}
+	}
+
+	clock_t elapsed = clock_diff(start, clock_read());
+
+	int largest = kheap_check(&test_heap);
+	int nfree = test_heap.total - test_heap.used;
+
+	printf("%d operations in %d ms, %d bytes used, largest free chunk %d of %d bytes...",
+		TEST_OPERATIONS, elapsed.seconds * 1000 + elapsed.millis,
+		test_heap.used, largest, nfree);
+
+	for(i = 0; i < TEST_SLOTS; i++) {
+		if(slot[i])
+			kheap_free(&test_heap, slot[i]);
+	}
+
+	return largest >= 0;
+}
+
 int kmalloc_test(void)
 {
 	int (*tests[]) (void) = {
-	kmalloc_test_single_alloc, kmalloc_test_single_alloc_and_free,};
+	kmalloc_test_single_alloc, kmalloc_test_single_alloc_and_free,
+	kmalloc_test_merge, kmalloc_test_arenas, kmalloc_test_stress,
+	kmalloc_test_timing,};
+
+	test_region = kmalloc(TEST_HEAP_LENGTH);
+	if(!test_region)
+		return 0;
 
 	int i = 0;
 	for(i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
@@ -216,10 +626,13 @@ int kmalloc_test(void)
 
 		if(!res) {
 			printf("failed\n");
-			printf("\ntest %d failed.\n");
+			printf("\ntest %d failed.\n", i);
+			kfree(test_region);
 			return 0;
 		}
 		printf("succeeded\n");
 	}
+
+	kfree(test_region);
 	return 1;
 }
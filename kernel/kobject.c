@@ -14,12 +14,16 @@
 #include "graphics.h"
 #include "console.h"
 #include "pipe.h"
+#include "page.h"
+#include "slab.h"
 
 #include "kernel/error.h"
 
+static struct slab_cache kobject_cache = SLAB_CACHE_INIT("kobject", sizeof(struct kobject), 0);
+
 static struct kobject *kobject_init()
 {
-	struct kobject *k = kmalloc(sizeof(*k));
+	struct kobject *k = slab_alloc(&kobject_cache);
 	k->refcount = 1;
 	k->offset = 0;
 	k->tag = 0;
@@ -196,6 +200,226 @@ int kobject_write(struct kobject *kobject, void *buffer, int size)
 	return 0;
 }
 
+/*
+writev gathers the buffers of an iovec array into a page and hands
+each page to a single kobject_write, so that a record made of several
+small pieces is one pipe write, or one update of each block it touches.
+readv reads a page at a time and scatters the data over the buffers.
+Both return the total number of bytes moved.
+*/
+
+int kobject_writev(struct kobject *kobject, const struct iovec *iov, int count)
+{
+	if(kobject->type == KOBJECT_GRAPHICS || kobject->type == KOBJECT_DIR)
+		return KERROR_INVALID_REQUEST;
+
+	char *page = page_alloc(0);
+	if(!page)
+		return KERROR_OUT_OF_MEMORY;
+
+	int total = 0;
+	int fill = 0;
+	int used = 0;
+	int i = 0;
+
+	while(1) {
+		while(i < count && fill < PAGE_SIZE) {
+			int n = MIN(iov[i].length - used, PAGE_SIZE - fill);
+			memcpy(page + fill, (char *) iov[i].base + used, n);
+			fill += n;
+			used += n;
+			if(used == iov[i].length) {
+				i++;
+				used = 0;
+			}
+		}
+
+		if(fill == 0)
+			break;
+
+		int actual = kobject_write(kobject, page, fill);
+		if(actual <= 0) {
+			if(total == 0)
+				total = actual;
+			break;
+		}
+
+		total += actual;
+		if(actual < fill)
+			break;
+		fill = 0;
+	}
+
+	page_free(page);
+	return total;
+}
+
+int kobject_readv(struct kobject *kobject, const struct iovec *iov, int count)
+{
+	if(kobject->type == KOBJECT_GRAPHICS || kobject->type == KOBJECT_DIR)
+		return KERROR_INVALID_REQUEST;
+
+	int remaining = 0;
+	int i;
+
+	for(i = 0; i < count; i++)
+		remaining += iov[i].length;
+
+	char *page = page_alloc(0);
+	if(!page)
+		return KERROR_OUT_OF_MEMORY;
+
+	int total = 0;
+	int used = 0;
+	i = 0;
+
+	while(remaining > 0) {
+		int want = MIN(PAGE_SIZE, remaining);
+		int actual = kobject_read(kobject, page, want);
+		if(actual <= 0) {
+			if(total == 0)
+				total = actual;
+			break;
+		}
+
+		int offset = 0;
+		while(offset < actual) {
+			int n = MIN(iov[i].length - used, actual - offset);
+			memcpy((char *) iov[i].base + used, page + offset, n);
+			offset += n;
+			used += n;
+			if(used == iov[i].length) {
+				i++;
+				used = 0;
+			}
+		}
+
+		total += actual;
+		remaining -= actual;
+		if(actual < want)
+			break;
+	}
+
+	page_free(page);
+	return total;
+}
+
+/*
+Set the offset of a file relative to the start, the current offset,
+or the end, and return the new offset.  An offset past the end is
+allowed, and a later write there extends the file.
+*/
+
+int kobject_seek(struct kobject *kobject, int offset, int whence)
+{
+	int base;
+
+	if(kobject->type != KOBJECT_FILE)
+		return KERROR_NOT_A_FILE;
+
+	switch (whence) {
+	case KERNEL_SEEK_SET:
+		base = 0;
+		break;
+	case KERNEL_SEEK_CUR:
+		base = kobject->offset;
+		break;
+	case KERNEL_SEEK_END:
+		base = fs_dirent_size(kobject->data.file);
+		break;
+	default:
+		return KERROR_INVALID_REQUEST;
+	}
+
+	if(base + offset < 0)
+		return KERROR_INVALID_REQUEST;
+
+	kobject->offset = base + offset;
+	return kobject->offset;
+}
+
+/*
+pread and pwrite take an explicit offset and leave the offset of the
+kobject alone, so that processes sharing a kobject can do random I/O
+without disturbing each other.
+*/
+
+int kobject_pread(struct kobject *kobject, void *buffer, int size, int offset)
+{
+	if(kobject->type != KOBJECT_FILE)
+		return KERROR_NOT_A_FILE;
+	if(size < 0 || offset < 0)
+		return KERROR_INVALID_REQUEST;
+	return fs_dirent_read(kobject->data.file, (char *) buffer, (uint32_t) size, (uint32_t) offset);
+}
+
+int kobject_pwrite(struct kobject *kobject, void *buffer, int size, int offset)
+{
+	if(kobject->type != KOBJECT_FILE)
+		return KERROR_NOT_A_FILE;
+	if(size < 0 || offset < 0)
+		return KERROR_INVALID_REQUEST;
+	return fs_dirent_write(kobject->data.file, (char *) buffer, (uint32_t) size, (uint32_t) offset);
+}
+
+/*
+Move up to length bytes from src to dst without leaving the kernel,
+starting at the current offset of each.  File to file goes through
+fs_dirent_transfer, and anything else is read and written a page at
+a time, stopping early when the source runs dry or dst stops taking data.
+*/
+
+int kobject_transfer(struct kobject *src, struct kobject *dst, int length)
+{
+	if(length < 0)
+		return KERROR_INVALID_REQUEST;
+	if(src->type == KOBJECT_DIR || dst->type == KOBJECT_DIR)
+		return KERROR_NOT_A_FILE;
+	if(src->type == KOBJECT_GRAPHICS || dst->type == KOBJECT_GRAPHICS)
+		return KERROR_INVALID_REQUEST;
+
+	if(src->type == KOBJECT_FILE && dst->type == KOBJECT_FILE) {
+		int actual = fs_dirent_transfer(src->data.file, src->offset, dst->data.file, dst->offset, length);
+		if(actual > 0) {
+			src->offset += actual;
+			dst->offset += actual;
+		}
+		return actual;
+	}
+
+	char *buffer = page_alloc(0);
+	if(!buffer)
+		return KERROR_OUT_OF_MEMORY;
+
+	int total = 0;
+
+	while(total < length) {
+		int actual = kobject_read(src, buffer, MIN(PAGE_SIZE, length - total));
+		if(actual <= 0)
+			break;
+
+		int written = 0;
+		while(written < actual) {
+			int w = kobject_write(dst, buffer + written, actual - written);
+			if(w <= 0)
+				break;
+			written += w;
+		}
+
+		total += written;
+
+		if(written < actual) {
+			// Leave the unwritten part of a file to be read again.
+			if(src->type == KOBJECT_FILE)
+				src->offset -= actual - written;
+			break;
+		}
+	}
+
+	page_free(buffer);
+	return total;
+}
+
 int kobject_list(struct kobject *kobject, void *buffer, int size)
 {
 	if(kobject->type==KOBJECT_DIR) {
@@ -205,6 +429,15 @@ int kobject_list(struct kobject *kobject, void *buffer, int size)
 	}
 }
 
+int kobject_readdir(struct kobject *kobject, void *buffer, int size, uint32_t *cookie)
+{
+	if(kobject->type==KOBJECT_DIR) {
+		return fs_dirent_readdir(kobject->data.dir,buffer,size,cookie);
+	} else {
+		return KERROR_NOT_A_DIRECTORY;
+	}
+}
+
 int kobject_lookup( struct kobject *kobject, const char *name, struct kobject **newobj )
 {
 	if(kobject->type==KOBJECT_DIR) {
@@ -274,6 +507,42 @@ int kobject_remove( struct kobject *kobject, const char *name )
 	return 0;
 }
 
+int kobject_sync( struct kobject *kobject, int datasync )
+{
+	switch (kobject->type) {
+	case KOBJECT_FILE:
+		return fs_dirent_sync(kobject->data.file,datasync);
+	case KOBJECT_DIR:
+		return fs_dirent_sync(kobject->data.dir,datasync);
+	default:
+		return 0;
+	}
+}
+
+int kobject_extents( struct kobject *kobject, struct fs_extent_stats *s )
+{
+	switch (kobject->type) {
+	case KOBJECT_FILE:
+		return fs_dirent_extents(kobject->data.file,s);
+	case KOBJECT_DIR:
+		return fs_dirent_extents(kobject->data.dir,s);
+	default:
+		return KERROR_NOT_IMPLEMENTED;
+	}
+}
+
+int kobject_defrag( struct kobject *kobject )
+{
+	switch (kobject->type) {
+	case KOBJECT_FILE:
+		return fs_dirent_defrag(kobject->data.file);
+	case KOBJECT_DIR:
+		return fs_dirent_defrag(kobject->data.dir);
+	default:
+		return KERROR_NOT_IMPLEMENTED;
+	}
+}
+
 int kobject_close(struct kobject *kobject)
 {
 	kobject->refcount--;
@@ -303,7 +572,7 @@ int kobject_close(struct kobject *kobject)
 		}
 		if (kobject->tag)
 			kfree(kobject->tag);
-		kfree(kobject);
+		slab_free(&kobject_cache, kobject);
 		return 0;
 	} else if(kobject->refcount>1 ) {
 		if(kobject->type==KOBJECT_PIPE) {
@@ -48,10 +48,20 @@ int kobject_read(struct kobject *kobject, void *buffer, int size);
 int kobject_read_nonblock(struct kobject *kobject, void *buffer, int size);
 int kobject_lookup( struct kobject *kobject, const char *name, struct kobject **newobj );
 int kobject_write(struct kobject *kobject, void *buffer, int size);
+int kobject_transfer(struct kobject *src, struct kobject *dst, int length);
+int kobject_readv(struct kobject *kobject, const struct iovec *iov, int count);
+int kobject_writev(struct kobject *kobject, const struct iovec *iov, int count);
+int kobject_seek(struct kobject *kobject, int offset, int whence);
+int kobject_pread(struct kobject *kobject, void *buffer, int size, int offset);
+int kobject_pwrite(struct kobject *kobject, void *buffer, int size, int offset);
 int kobject_list( struct kobject *kobject, void *buffer, int size );
+int kobject_readdir( struct kobject *kobject, void *buffer, int size, uint32_t *cookie );
 int kobject_size(struct kobject *kobject, int *dimensions, int n);
 struct kobject * kobject_copy( struct kobject *ksrc, struct kobject **kdst );
 int kobject_remove( struct kobject *kobject, const char *name );
+int kobject_extents( struct kobject *kobject, struct fs_extent_stats *s );
+int kobject_defrag( struct kobject *kobject );
+int kobject_sync( struct kobject *kobject, int datasync );
 int kobject_close(struct kobject *kobject);
 
 int kobject_set_blocking(struct kobject *kobject, int b);
@@ -21,7 +21,12 @@ See the file LICENSE for details.
 #include "clock.h"
 #include "kernelcore.h"
 #include "bcache.h"
+#include "diskfs.h"
 #include "printf.h"
+#include "loop.h"
+#include "tmpfs.h"
+#include "slab.h"
+#include "graphics.h"
 
 static int kshell_mount( const char *devname, int unit, const char *fs_type)
 {
@@ -34,21 +39,22 @@ static int kshell_mount( const char *devname, int unit, const char *fs_type)
 				struct fs_dirent *d = fs_volume_root(v);
 				if(d) {
 					if(current->root_dir) fs_dirent_close(current->root_dir);
+					if(current->current_dir) fs_dirent_close(current->current_dir);
 					current->root_dir = d;
 					current->current_dir = fs_dirent_addref(d);
+					// The root holds the volume, and the volume holds the device.
+					fs_volume_close(v);
+					device_close(dev);
 					return 0;
 				} else {
 					printf("mount: couldn't find root dir on %s unit %d!\n",device_name(dev),device_unit(dev));
-					return -1;
 				}
 				fs_volume_close(v);
 			} else {
 				printf("mount: couldn't mount %s on %s unit %d\n",fs_type,device_name(dev),device_unit(dev));
-				return -1;
 			}
 		} else {
 			printf("mount: invalid fs type: %s\n", fs_type);
-			return -1;
 		}
 		device_close(dev);
 	} else {
@@ -59,6 +65,74 @@ static int kshell_mount( const char *devname, int unit, const char *fs_type)
 	return -1;
 }
 
+/*
+Mount a filesystem image stored in a file by attaching
+the file to a loop device, and then mounting that device.
+*/
+
+static int kshell_mount_file( const char *path, const char *fs_type )
+{
+	struct fs_dirent *d = fs_resolve(path);
+	if(!d) {
+		printf("mount: couldn't find %s\n",path);
+		return -1;
+	}
+
+	// The unit goes away by itself when the volume on it is unmounted.
+	int unit = loop_attach(d, 1);
+	fs_dirent_close(d);
+
+	if(unit<0) {
+		printf("mount: couldn't attach %s to a loop device\n",path);
+		return -1;
+	}
+
+	if(kshell_mount("loop",unit,fs_type)<0) {
+		loop_detach(unit);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+Mount a filesystem that needs no device, such as tmpfs,
+on top of an existing directory.
+*/
+
+static int kshell_mount_dir( const char *fs_type, const char *path )
+{
+	struct fs *fs = fs_lookup(fs_type);
+
+	struct fs_dirent *dir = fs_resolve(path);
+	if(!dir) {
+		printf("mount: couldn't find %s\n",path);
+		return -1;
+	}
+
+	struct fs_volume *v = fs_volume_open(fs,0);
+	if(!v) {
+		printf("mount: couldn't mount %s without a device\n",fs_type);
+		fs_dirent_close(dir);
+		return -1;
+	}
+
+	struct fs_dirent *root = fs_volume_root(v);
+	fs_volume_close(v);
+	if(!root) {
+		printf("mount: couldn't find root dir of %s\n",fs_type);
+		fs_dirent_close(dir);
+		return -1;
+	}
+
+	int result = fs_dirent_mount(dir,root);
+	if(result<0) printf("mount: couldn't mount %s on %s\n",fs_type,path);
+
+	fs_dirent_close(root);
+	fs_dirent_close(dir);
+	return result;
+}
+
 /*
 Install software from the cdrom volume unit src
 to the disk volume dst by performing a recursive copy.
@@ -87,6 +161,11 @@ int kshell_install( int src, int dst )
 
 	printf("copying atapi unit %d to ata unit %d...\n",src,dst);
 
+	struct device_driver_stats rbefore, rafter, wbefore, wafter;
+	device_driver_get_stats("atapi",&rbefore);
+	device_driver_get_stats("ata",&wbefore);
+	clock_t start = clock_read();
+
 	fs_dirent_copy(srcroot, dstroot,0);
 
 	fs_dirent_close(dstroot);
@@ -100,6 +179,61 @@ int kshell_install( int src, int dst )
 	bcache_flush_device(dstdev);
 	device_close(dstdev);
 
+	clock_t elapsed = clock_diff(start,clock_read());
+	device_driver_get_stats("atapi",&rafter);
+	device_driver_get_stats("ata",&wafter);
+
+	printf("install: %d atapi blocks read, %d ata blocks written in %d ms\n",
+		rafter.blocks_read-rbefore.blocks_read,
+		wafter.blocks_written-wbefore.blocks_written,
+		elapsed.seconds*1000+elapsed.millis);
+
+	return 0;
+}
+
+/*
+Measure the cost of loading a program image, by reading the
+whole file the same way that elf_load does, count times over.
+Reports the elapsed time and the number of atapi blocks read.
+*/
+
+static int kshell_loadbench( const char *path, int count )
+{
+	struct device_driver_stats before, after;
+	int i;
+
+	char *buffer = page_alloc(0);
+	if(!buffer) return KERROR_OUT_OF_MEMORY;
+
+	device_driver_get_stats("atapi",&before);
+	clock_t start = clock_read();
+	uint32_t size = 0;
+
+	for(i=0;i<count;i++) {
+		struct fs_dirent *d = fs_resolve(path);
+		if(!d) {
+			printf("loadbench: couldn't find %s\n",path);
+			page_free(buffer);
+			return KERROR_NOT_FOUND;
+		}
+
+		uint32_t offset;
+		size = fs_dirent_size(d);
+		for(offset=0;offset<size;offset+=PAGE_SIZE) {
+			fs_dirent_read(d,buffer,MIN(PAGE_SIZE,size-offset),offset);
+		}
+		fs_dirent_close(d);
+	}
+
+	clock_t elapsed = clock_diff(start,clock_read());
+	device_driver_get_stats("atapi",&after);
+	page_free(buffer);
+
+	printf("loadbench: %d loads of %s (%d bytes) in %d ms, %d atapi blocks read\n",
+		count, path, size,
+		elapsed.seconds*1000+elapsed.millis,
+		after.blocks_read-before.blocks_read);
+
 	return 0;
 }
 
@@ -184,14 +318,29 @@ static int kshell_execute(int argc, const char **argv)
 			} else {
 				printf("mount: expected unit number but got %s\n", argv[2]);
 			}
+		} else if(argc==3 && fs_lookup(argv[1])) {
+			kshell_mount_dir(argv[1],argv[2]);
+		} else if(argc==3) {
+			kshell_mount_file(argv[1],argv[2]);
 		} else {
-			printf("mount: requires device, unit, and fs type\n");
+			printf("mount: requires device, unit, and fs type, or image file and fs type, or fs type and directory\n");
 		}
 	} else if(!strcmp(cmd, "umount")) {
-		if(current->root_dir) {
+		if(argc==2) {
+			struct fs_dirent *d = fs_resolve(argv[1]);
+			if(d) {
+				if(fs_dirent_unmount(d)<0) printf("umount: nothing mounted on %s\n",argv[1]);
+				fs_dirent_close(d);
+			} else {
+				printf("umount: couldn't find %s\n",argv[1]);
+			}
+		} else if(current->root_dir) {
 			printf("unmounting root directory\n");
 			fs_dirent_close(current->root_dir);
 			current->root_dir = 0;
+			// The working directory holds the volume too, and so its device.
+			if(current->current_dir) fs_dirent_close(current->current_dir);
+			current->current_dir = 0;
 		} else {
 			printf("nothing currently mounted\n");
 		}
@@ -250,9 +399,20 @@ static int kshell_execute(int argc, const char **argv)
 				clock_wait(1000);
 			}
 			uint32_t nfree, ntotal;
-			page_stats(&nfree,&ntotal);
+			page_stats(&nfree,&ntotal,0);
 			printf("memory: %d/%d\n",nfree,ntotal);
 		}
+	} else if(!strcmp(cmd, "loadbench")) {
+		if(argc == 3) {
+			int count;
+			if(str2int(argv[2], &count)) {
+				kshell_loadbench(argv[1], count);
+			} else {
+				printf("loadbench: expected count but got %s\n", argv[2]);
+			}
+		} else {
+			printf("use: loadbench <path> <count>\n");
+		}
 	} else if(!strcmp(cmd, "mkdir")) {
 		if(argc == 3) {
 			struct fs_dirent *dir = fs_resolve(argv[1]);
@@ -328,14 +488,48 @@ static int kshell_execute(int argc, const char **argv)
 	} else if(!strcmp(cmd, "bcache_stats")) {
 		struct bcache_stats stats;
 		bcache_get_stats(&stats);
-		printf("%d rhit %d rmiss %d whit %d wmiss %d wback\n",
+		printf("%d rhit %d rmiss %d whit %d wmiss %d wback %d rahead\n",
 			stats.read_hits,stats.read_misses,
 			stats.write_hits,stats.write_misses,
-			stats.writebacks);
+			stats.writebacks,stats.readaheads);
+	} else if(!strcmp(cmd, "slab_stats")) {
+		struct slab_stats stats;
+		int i;
+		printf("cache          size active slabs (p/f/e) allocs hit%%\n");
+		for(i = 0; slab_get_stats(i, &stats); i++) {
+			printf("%s %d %d %d (%d/%d/%d) %d %d\n",
+				stats.name,stats.size,stats.active,stats.slabs,
+				stats.partial,stats.full,stats.empty,stats.allocs,
+				stats.allocs ? stats.hits*100/stats.allocs : 0);
+		}
+	} else if(!strcmp(cmd, "page_stats")) {
+		uint32_t nfree, ntotal, nblocks[PAGE_MAX_ORDER+1];
+		int order;
+		page_stats(&nfree,&ntotal,nblocks);
+		printf("memory: %d/%d pages free\n",nfree,ntotal);
+		for(order=0;order<=PAGE_MAX_ORDER;order++) {
+			printf("order %d: %d free\n",order,nblocks[order]);
+		}
+		struct page_pool_stats pool;
+		page_pool_get_stats(&pool);
+		printf("zeroed pool: %d pages, %d hits %d misses %d refills\n",
+			pool.count,pool.hits,pool.misses,pool.refills);
+	} else if(!strcmp(cmd, "page_bench")) {
+		page_bench();
+	} else if(!strcmp(cmd, "graphics_bench")) {
+		graphics_bench();
+	} else if(!strcmp(cmd, "kmalloc_test")) {
+		kmalloc_test();
+	} else if(!strcmp(cmd, "tmpfs_stats")) {
+		struct tmpfs_stats stats;
+		tmpfs_get_stats(&stats);
+		printf("tmpfs: %d/%d pages used, %d nodes\n",
+			stats.pages_used,stats.pages_max,stats.nodes);
 	} else if(!strcmp(cmd,"bcache_flush")) {
+		diskfs_journal_commit_all();
 		bcache_flush_all();
 	} else if(!strcmp(cmd, "help")) {
-		printf("Kernel Shell Commands:\nrun <path> <args>\nstart <path> <args>\nkill <pid>\nreap <pid>\nwait\nlist\nmount <device> <unit> <fstype>\numount\nformat <device> <unit><fstype>\ninstall <srcunit> <dstunit>\nchdir <path>\nmkdir <path>\nremove <path>time\nbcache_stats\nbcache_flush\nreboot\nhelp\n\n");
+		printf("Kernel Shell Commands:\nrun <path> <args>\nstart <path> <args>\nkill <pid>\nreap <pid>\nwait\nlist\nmount <device> <unit> <fstype>\nmount <imagefile> <fstype>\nmount <fstype> <dir>\numount [<dir>]\nformat <device> <unit><fstype>\ninstall <srcunit> <dstunit>\nchdir <path>\nmkdir <path>\nremove <path>time\nbcache_stats\nbcache_flush\npage_stats\npage_bench\ngraphics_bench\nslab_stats\nkmalloc_test\ntmpfs_stats\nloadbench <path> <count>\nreboot\nhelp\n\n");
 	} else {
 		printf("%s: command not found\n", argv[0]);
 	}
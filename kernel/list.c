@@ -108,9 +108,9 @@ void list_remove(struct list_node *node)
 	}
 	node->next->prev = node->prev;
 	node->prev->next = node->next;
+	node->list->size--;
 	node->next = node->prev = 0;
 	node->list = 0;
-	node->list->size--;
 }
 
 int list_size( struct list *list )
@@ -0,0 +1,106 @@
+/*
+Copyright (C) 2016-2019 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file LICENSE for details.
+*/
+
+#include "loop.h"
+#include "device.h"
+#include "string.h"
+#include "kernel/error.h"
+
+static struct fs_dirent *loop_units[LOOP_MAX_UNITS] = { 0 };
+static int loop_autoclear[LOOP_MAX_UNITS] = { 0 };
+
+int loop_attach(struct fs_dirent *d, int autoclear)
+{
+	int i;
+
+	if(fs_dirent_isdir(d))
+		return KERROR_NOT_A_FILE;
+
+	for(i = 0; i < LOOP_MAX_UNITS; i++) {
+		if(!loop_units[i]) {
+			loop_units[i] = fs_dirent_addref(d);
+			loop_autoclear[i] = autoclear;
+			return i;
+		}
+	}
+
+	return KERROR_OUT_OF_OBJECTS;
+}
+
+void loop_detach(int unit)
+{
+	if(unit >= 0 && unit < LOOP_MAX_UNITS && loop_units[unit]) {
+		fs_dirent_close(loop_units[unit]);
+		loop_units[unit] = 0;
+		loop_autoclear[unit] = 0;
+	}
+}
+
+static void loop_release(int unit)
+{
+	if(unit >= 0 && unit < LOOP_MAX_UNITS && loop_autoclear[unit])
+		loop_detach(unit);
+}
+
+static int loop_probe(int unit, int *nblocks, int *blocksize, char *info)
+{
+	if(unit < 0 || unit >= LOOP_MAX_UNITS || !loop_units[unit])
+		return 0;
+
+	int size = fs_dirent_size(loop_units[unit]);
+
+	*blocksize = LOOP_BLOCK_SIZE;
+	*nblocks = size / LOOP_BLOCK_SIZE + (size % LOOP_BLOCK_SIZE ? 1 : 0);
+	strcpy(info, "loop");
+
+	return 1;
+}
+
+/*
+Reads past the end of the file are filled with zeros,
+so that the last partial block appears as a whole block.
+*/
+
+static int loop_read(int unit, void *buffer, int nblocks, int offset)
+{
+	if(unit < 0 || unit >= LOOP_MAX_UNITS || !loop_units[unit])
+		return 0;
+
+	int length = nblocks * LOOP_BLOCK_SIZE;
+	int actual = fs_dirent_read(loop_units[unit], buffer, length, offset * LOOP_BLOCK_SIZE);
+	if(actual < 0)
+		return 0;
+
+	memset((char *) buffer + actual, 0, length - actual);
+	return nblocks;
+}
+
+static int loop_write(int unit, const void *buffer, int nblocks, int offset)
+{
+	if(unit < 0 || unit >= LOOP_MAX_UNITS || !loop_units[unit])
+		return 0;
+
+	int length = nblocks * LOOP_BLOCK_SIZE;
+	int actual = fs_dirent_write(loop_units[unit], buffer, length, offset * LOOP_BLOCK_SIZE);
+	if(actual != length)
+		return 0;
+
+	return nblocks;
+}
+
+static struct device_driver loop_driver = {
+	.name          = "loop",
+	.probe         = loop_probe,
+	.read          = loop_read,
+	.read_nonblock = loop_read,
+	.write         = loop_write,
+	.release       = loop_release,
+};
+
+void loop_init()
+{
+	device_driver_register(&loop_driver);
+}
@@ -0,0 +1,27 @@
+/*
+Copyright (C) 2016-2019 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file LICENSE for details.
+*/
+
+#ifndef LOOP_H
+#define LOOP_H
+
+#include "fs.h"
+
+/*
+The loop device presents an ordinary file as a block device,
+so that a filesystem image stored in a file can be mounted.
+loop_attach returns the unit number to pass to device_open("loop",unit).
+With autoclear, the unit is detached by itself when the device opened
+on it is closed for the last time, as when the volume on it is unmounted.
+*/
+
+#define LOOP_MAX_UNITS 4
+#define LOOP_BLOCK_SIZE 4096
+
+void loop_init();
+int  loop_attach(struct fs_dirent *d, int autoclear);
+void loop_detach(int unit);
+
+#endif
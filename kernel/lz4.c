@@ -0,0 +1,79 @@
+/*
+Copyright (C) 2016-2019 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file LICENSE for details.
+*/
+
+#include "lz4.h"
+#include "string.h"
+#include "kernel/types.h"
+
+/*
+An LZ4 block is a sequence of (literals, match) pairs.
+Each sequence begins with a token byte: the high nibble is
+the literal length, the low nibble is the match length minus 4.
+A nibble of 15 means that more length bytes follow, each added
+to the total until a byte other than 255 is seen.  The literals
+are followed by a two byte little-endian offset back into the output.
+The final sequence consists of literals only.
+*/
+
+static int lz4_length(const uint8_t **ip, const uint8_t *iend, uint32_t *length)
+{
+	uint8_t s;
+	do {
+		if(*ip >= iend)
+			return 0;
+		s = *(*ip)++;
+		*length += s;
+	} while(s == 255);
+	return 1;
+}
+
+int lz4_decompress(const char *src, int srclen, char *dst, int dstlen)
+{
+	const uint8_t *ip = (const uint8_t *) src;
+	const uint8_t *iend = ip + srclen;
+	uint8_t *op = (uint8_t *) dst;
+	uint8_t *oend = op + dstlen;
+
+	while(ip < iend) {
+		uint32_t token = *ip++;
+		uint32_t length = token >> 4;
+
+		if(length == 15 && !lz4_length(&ip, iend, &length))
+			return -1;
+		if(length > iend - ip || length > oend - op)
+			return -1;
+
+		memcpy(op, ip, length);
+		op += length;
+		ip += length;
+
+		// The last sequence has no match part.
+		if(ip >= iend)
+			break;
+
+		if(iend - ip < 2)
+			return -1;
+		uint32_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if(offset == 0 || offset > op - (uint8_t *) dst)
+			return -1;
+
+		length = token & 15;
+		if(length == 15 && !lz4_length(&ip, iend, &length))
+			return -1;
+		length += 4;
+		if(length > oend - op)
+			return -1;
+
+		// Matches may overlap the output, so copy byte by byte.
+		const uint8_t *match = op - offset;
+		while(length--) {
+			*op++ = *match++;
+		}
+	}
+
+	return op - (uint8_t *) dst;
+}
@@ -0,0 +1,18 @@
+/*
+Copyright (C) 2016-2019 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file LICENSE for details.
+*/
+
+#ifndef LZ4_H
+#define LZ4_H
+
+/*
+Decompress a single raw LZ4 block (no frame header) of srclen bytes
+into dst, which may hold at most dstlen bytes.  Returns the number of
+bytes produced, or -1 if the input is malformed or would overflow dst.
+*/
+
+int lz4_decompress(const char *src, int srclen, char *dst, int dstlen);
+
+#endif
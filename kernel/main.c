@@ -21,10 +21,15 @@ See the file LICENSE for details.
 #include "rtc.h"
 #include "kernelcore.h"
 #include "kmalloc.h"
+#include "vmalloc.h"
 #include "memorylayout.h"
 #include "kshell.h"
 #include "cdromfs.h"
 #include "diskfs.h"
+#include "imagefs.h"
+#include "loop.h"
+#include "tmpfs.h"
+#include "initramfs.h"
 #include "serial.h"
 
 /*
@@ -45,6 +50,8 @@ int kernel_main()
 	printf("kernel: %d bytes\n", kernel_size);
 
 	page_init();
+	pagetable_kernel_init();
+	vmalloc_init();
 	kmalloc_init((char *) KMALLOC_START, KMALLOC_LENGTH);
 	interrupt_init();
 	rtc_init();
@@ -55,6 +62,10 @@ int kernel_main()
 	ata_init();
 	cdrom_init();
 	diskfs_init();
+	imagefs_init();
+	loop_init();
+	tmpfs_init();
+	initramfs_init();
 
 	printf("\nKERNEL SHELL READY:\n");
 	kshell_launch();
@@ -70,6 +70,16 @@ main memory is determined dynamically at bootup time.
 
 #define MAIN_MEMORY_START  0x200000
 
+/*
+Large kernel buffers, and any growth of the kmalloc area, are built
+by vmalloc out of individual pages mapped into this range, which
+lies between the direct map of main memory and the user-mode space.
+The page tables covering it are shared by every address space.
+*/
+
+#define KERNEL_VMALLOC_START 0x70000000
+#define KERNEL_VMALLOC_END   0x74000000
+
 /*
 We choose the user-mode address space to begin at 0x80000000,
 and the user-mode stack to start at the top of memory and
@@ -78,3 +88,11 @@ grow down.  Addresses below 0x80000000 are all supervisor mode.
 
 #define PROCESS_ENTRY_POINT 0x80000000
 #define PROCESS_STACK_INIT  0xfffffff0
+
+/*
+Files mapped into a process are placed from 0xc0000000 upward,
+clear of both the data area and the stack.
+*/
+
+#define PROCESS_MMAP_START  0xc0000000
+#define PROCESS_MMAP_END    0xf0000000
@@ -0,0 +1,179 @@
+/*
+Copyright (C) 2016-2019 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file LICENSE for details.
+*/
+
+#include "mmap.h"
+#include "pcache.h"
+#include "pagetable.h"
+#include "memorylayout.h"
+#include "kmalloc.h"
+#include "list.h"
+#include "fs_internal.h"
+#include "kernel/error.h"
+
+struct mmap_region {
+	struct list_node node;
+	uint32_t start;
+	uint32_t length;
+	uint32_t offset;
+	int flags;
+	struct fs_dirent *file;
+};
+
+static struct mmap_region *mmap_find(struct process *p, uint32_t vaddr)
+{
+	struct list_node *n;
+
+	for(n = p->mmap_list.head; n; n = n->next) {
+		struct mmap_region *r = (struct mmap_region *) n;
+		if(vaddr >= r->start && vaddr < r->start + r->length)
+			return r;
+	}
+
+	return 0;
+}
+
+/*
+Reserve address space for a mapping.  No pages are mapped until they
+are touched.  Space is handed out in order and is not reused, which is
+ample for the few mappings a process is expected to make.
+*/
+
+int mmap_create(struct process *p, struct fs_dirent *d, uint32_t offset, uint32_t length, int flags, uint32_t *addr)
+{
+	if(offset % PAGE_SIZE || length == 0)
+		return KERROR_INVALID_REQUEST;
+	if(d->isdir)
+		return KERROR_NOT_A_FILE;
+	if((flags & KERNEL_MMAP_SHARED) && !d->volume->fs->ops->write_block)
+		return KERROR_PERMISSION_DENIED;
+
+	if(length % PAGE_SIZE)
+		length += PAGE_SIZE - length % PAGE_SIZE;
+
+	if(p->vm_mmap_next + length > PROCESS_MMAP_END || p->vm_mmap_next + length < p->vm_mmap_next)
+		return KERROR_OUT_OF_MEMORY;
+
+	struct mmap_region *r = kmalloc(sizeof(*r));
+	if(!r)
+		return KERROR_OUT_OF_MEMORY;
+
+	r->start = p->vm_mmap_next;
+	r->length = length;
+	r->offset = offset;
+	r->flags = flags;
+	r->file = fs_dirent_addref(d);
+
+	p->vm_mmap_next += length;
+	list_push_tail(&p->mmap_list, &r->node);
+
+	*addr = r->start;
+	return 0;
+}
+
+static void mmap_region_delete(struct process *p, struct mmap_region *r)
+{
+	uint32_t vaddr;
+
+	for(vaddr = r->start; vaddr < r->start + r->length; vaddr += PAGE_SIZE) {
+		unsigned paddr;
+		if(pagetable_getmap(p->pagetable, vaddr, &paddr, 0)) {
+			pagetable_unmap(p->pagetable, vaddr);
+			pcache_unmap((char *) paddr);
+		}
+	}
+
+	list_remove(&r->node);
+	fs_dirent_close(r->file);
+	kfree(r);
+}
+
+int mmap_delete(struct process *p, uint32_t addr)
+{
+	struct mmap_region *r = mmap_find(p, addr);
+	if(!r || r->start != addr)
+		return KERROR_INVALID_ADDRESS;
+
+	mmap_region_delete(p, r);
+	pagetable_refresh();
+	return 0;
+}
+
+void mmap_delete_all(struct process *p)
+{
+	while(p->mmap_list.head) {
+		mmap_region_delete(p, (struct mmap_region *) p->mmap_list.head);
+	}
+	p->vm_mmap_next = PROCESS_MMAP_START;
+}
+
+/*
+The child gets a copy of every region.  pagetable_duplicate has already
+shared the pages mapped so far, so each of those gains a mapping.
+*/
+
+void mmap_inherit(struct process *parent, struct process *child)
+{
+	struct list_node *n;
+
+	for(n = parent->mmap_list.head; n; n = n->next) {
+		struct mmap_region *r = (struct mmap_region *) n;
+		struct mmap_region *c = kmalloc(sizeof(*c));
+		if(!c)
+			break;
+
+		*c = *r;
+		c->file = fs_dirent_addref(r->file);
+		list_push_tail(&child->mmap_list, &c->node);
+
+		uint32_t vaddr;
+		for(vaddr = c->start; vaddr < c->start + c->length; vaddr += PAGE_SIZE) {
+			unsigned paddr;
+			if(pagetable_getmap(child->pagetable, vaddr, &paddr, 0))
+				pcache_addref((char *) paddr);
+		}
+	}
+
+	child->vm_mmap_next = parent->vm_mmap_next;
+}
+
+/*
+A page is first mapped read-only, even in a shared mapping, so that
+the first write faults again and marks the cached page dirty.
+*/
+
+int mmap_fault(struct process *p, uint32_t vaddr, int write)
+{
+	struct mmap_region *r = mmap_find(p, vaddr);
+	if(!r)
+		return 0;
+
+	if(write && !(r->flags & KERNEL_MMAP_SHARED))
+		return -1;
+
+	uint32_t page = vaddr & ~(PAGE_SIZE - 1);
+	unsigned paddr;
+
+	if(pagetable_getmap(p->pagetable, page, &paddr, 0)) {
+		if(!write)
+			return -1;
+		if(!pagetable_map(p->pagetable, page, paddr, PAGE_FLAG_USER | PAGE_FLAG_READWRITE))
+			return -1;
+		pcache_dirty((char *) paddr);
+	} else {
+		char *data = pcache_map(r->file, (r->offset + page - r->start) / PAGE_SIZE);
+		if(!data)
+			return -1;
+		if(!pagetable_map(p->pagetable, page, (unsigned) data, PAGE_FLAG_USER | (write ? PAGE_FLAG_READWRITE : PAGE_FLAG_READONLY))) {
+			pcache_unmap(data);
+			return -1;
+		}
+		if(write)
+			pcache_dirty(data);
+	}
+
+	pagetable_refresh();
+	return 1;
+}
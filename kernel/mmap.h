@@ -0,0 +1,27 @@
+/*
+Copyright (C) 2016-2019 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file LICENSE for details.
+*/
+
+#ifndef MMAP_H
+#define MMAP_H
+
+#include "kernel/types.h"
+#include "process.h"
+
+/*
+A process may map parts of files into its address space, either
+read-only and private, or writable and shared with the file.
+Pages are brought in from the page cache on first touch, by
+mmap_fault, which returns 1 if the fault was handled, 0 if the
+address is not in a mapping, and -1 if the access is not allowed.
+*/
+
+int  mmap_create(struct process *p, struct fs_dirent *d, uint32_t offset, uint32_t length, int flags, uint32_t *addr);
+int  mmap_delete(struct process *p, uint32_t addr);
+void mmap_delete_all(struct process *p);
+void mmap_inherit(struct process *parent, struct process *child);
+int  mmap_fault(struct process *p, uint32_t vaddr, int write);
+
+#endif
@@ -10,96 +10,403 @@ See the file LICENSE for details.
 #include "string.h"
 #include "memorylayout.h"
 #include "kernelcore.h"
+#include "clock.h"
+#include "kernel/error.h"
+
+/*
+Pages are managed by a binary buddy allocator.  A block of order n
+is 2^n contiguous pages, aligned to its own size.  For each order,
+a bitmap has one bit per block, set while that block is free and
+not part of a larger free block.  Allocation takes the first free
+block of the smallest order that fits, splitting it in halves down
+to the order requested, and freeing merges a block with its buddy
+for as long as the buddy is free too, so each costs at most one
+step per order.
+
+To find a free block without a walk over the bitmap, each order
+also has a summary bitmap, with one bit per cell of the freemap,
+set while that cell has any free block.  A hint records the first
+summary cell that may be non-empty, so a search skips over memory
+that is already full, and uses a bit scan at each level.
+*/
 
 static uint32_t pages_free = 0;
 static uint32_t pages_total = 0;
+static uint32_t pages_reserved = 0;
 
-static uint32_t *freemap = 0;
-static uint32_t freemap_bits = 0;
-static uint32_t freemap_bytes = 0;
-static uint32_t freemap_cells = 0;
+static uint32_t *freemap[PAGE_MAX_ORDER + 1];
+static uint32_t freemap_cells[PAGE_MAX_ORDER + 1];
 static uint32_t freemap_pages = 0;
 
+static uint32_t *summary[PAGE_MAX_ORDER + 1];
+static uint32_t summary_cells[PAGE_MAX_ORDER + 1];
+static uint32_t summary_hint[PAGE_MAX_ORDER + 1];
+
+static uint32_t blocks_free[PAGE_MAX_ORDER + 1];
+
+/*
+A page shared copy-on-write by several address spaces has a count
+of its extra owners, so that page_free only frees it when the last
+owner lets go.  A page with a single owner, as most are, counts zero.
+*/
+
+static uint16_t *page_refs = 0;
+
+#define PAGE_REFS_MAX 0xffff
+
+/*
+The idle loop keeps a pool of pages that are already zeroed,
+so that page_alloc(1) -- for page tables, process memory and
+cleared heap pages -- doesn't have to zero a page on the spot.
+The pool is only refilled while plenty of memory is free, and
+its pages are used for any request once the allocator runs dry.
+*/
+
+#define PAGE_POOL_SIZE 64
+#define PAGE_POOL_MIN_FREE (4*PAGE_POOL_SIZE)
+
+static void *pool[PAGE_POOL_SIZE];
+static int pool_count = 0;
+static struct page_pool_stats pool_stats = {0};
+
 static void *main_memory_start = (void *) MAIN_MEMORY_START;
 
-#define CELL_BITS (8*sizeof(*freemap))
+#define CELL_BITS 32
+
+/*
+This is a hack that I don't understand yet.
+vmware doesn't like the use of a particular page
+close to 1MB, but what it is used for I don't know.
+So, the first cell's worth of pages is never handed out.
+*/
+
+#define PAGES_RESERVED CELL_BITS
+
+static int block_test(int order, uint32_t block)
+{
+	return freemap[order][block / CELL_BITS] & (1 << (block % CELL_BITS));
+}
+
+static void block_set(int order, uint32_t block)
+{
+	uint32_t cell = block / CELL_BITS;
+	uint32_t s = cell / CELL_BITS;
+
+	freemap[order][cell] |= (1 << (block % CELL_BITS));
+	summary[order][s] |= (1 << (cell % CELL_BITS));
+	if(s < summary_hint[order])
+		summary_hint[order] = s;
+	blocks_free[order]++;
+}
+
+static void block_clear(int order, uint32_t block)
+{
+	uint32_t cell = block / CELL_BITS;
+
+	freemap[order][cell] &= ~(1 << (block % CELL_BITS));
+	if(!freemap[order][cell])
+		summary[order][cell / CELL_BITS] &= ~(1 << (cell % CELL_BITS));
+	blocks_free[order]--;
+}
+
+static int bit_first(uint32_t x)
+{
+	return __builtin_ctz(x);
+}
+
+/* Find the first free block of this order, returning it, or -1. */
+
+static int block_find(int order)
+{
+	uint32_t s, cell;
+
+	if(!blocks_free[order])
+		return -1;
+
+	for(s = summary_hint[order]; s < summary_cells[order]; s++) {
+		if(summary[order][s]) {
+			summary_hint[order] = s;
+			cell = s * CELL_BITS + bit_first(summary[order][s]);
+			return cell * CELL_BITS + bit_first(freemap[order][cell]);
+		}
+	}
+
+	summary_hint[order] = summary_cells[order];
+	return -1;
+}
 
 void page_init()
 {
-	int i;
+	uint32_t i, order, cells;
 
 	pages_total = (total_memory * 1024 * 1024 - MAIN_MEMORY_START) / PAGE_SIZE;
-	pages_free = pages_total;
-	printf("memory: %d MB (%d KB) total\n", (pages_free * PAGE_SIZE) / MEGA, (pages_free * PAGE_SIZE) / KILO);
+	printf("memory: %d MB (%d KB) total\n", (pages_total * PAGE_SIZE) / MEGA, (pages_total * PAGE_SIZE) / KILO);
 
-	freemap = main_memory_start;
-	freemap_bits = pages_total;
-	freemap_bytes = 1 + freemap_bits / 8;
-	freemap_cells = 1 + freemap_bits / CELL_BITS;
-	freemap_pages = 1 + freemap_bytes / PAGE_SIZE;
+	// The bitmaps of all orders are placed one after the other at the start of main memory.
+	uint32_t *next = main_memory_start;
+	cells = 0;
+	for(order = 0; order <= PAGE_MAX_ORDER; order++) {
+		freemap[order] = next;
+		freemap_cells[order] = 1 + (pages_total >> order) / CELL_BITS;
+		next += freemap_cells[order];
+		summary[order] = next;
+		summary_cells[order] = 1 + freemap_cells[order] / CELL_BITS;
+		next += summary_cells[order];
+		cells += freemap_cells[order] + summary_cells[order];
+	}
+
+	// The reference counts follow the bitmaps.
+	page_refs = (uint16_t *) next;
 
-	printf("memory: %d bits %d bytes %d cells %d pages\n", freemap_bits, freemap_bytes, freemap_cells, freemap_pages);
+	uint32_t length = cells * sizeof(uint32_t) + pages_total * sizeof(uint16_t);
+	freemap_pages = 1 + length / PAGE_SIZE;
+	memset(main_memory_start, 0, length);
 
-	memset(freemap, 0xff, freemap_bytes);
-	for(i = 0; i < freemap_pages; i++)
-		page_alloc(0);
+	printf("memory: %d orders %d cells %d pages\n", PAGE_MAX_ORDER + 1, cells, freemap_pages);
 
-	// This is ahack that I don't understand yet.
-	// vmware doesn't like the use of a particular page
-	// close to 1MB, but what it is used for I don't know.
+	pages_reserved = MAX(freemap_pages, PAGES_RESERVED);
+
+	// Cover the remaining pages with the largest aligned blocks that fit.
+	i = pages_reserved;
+	while(i < pages_total) {
+		order = PAGE_MAX_ORDER;
+		while(order > 0 && ((i & ((1 << order) - 1)) || i + (1 << order) > pages_total))
+			order--;
+		block_set(order, i >> order);
+		i += 1 << order;
+	}
 
-	freemap[0] = 0x0;
+	pages_free = pages_total - pages_reserved;
 
 	printf("memory: %d MB (%d KB) available\n", (pages_free * PAGE_SIZE) / MEGA, (pages_free * PAGE_SIZE) / KILO);
 }
 
-void page_stats( uint32_t *nfree, uint32_t *ntotal )
+void page_stats( uint32_t *nfree, uint32_t *ntotal, uint32_t *nblocks )
 {
-	*nfree = pages_free;
+	int order;
+
+	*nfree = pages_free + pool_count;
 	*ntotal = pages_total;
+
+	if(nblocks) {
+		for(order = 0; order <= PAGE_MAX_ORDER; order++)
+			nblocks[order] = blocks_free[order];
+	}
 }
 
-void *page_alloc(bool zeroit)
+/*
+Zero pages with rep stosl, which stores a word at a time and is
+handled by the processor as a block operation, rather than byte
+by byte as memset does.
+*/
+
+static void page_zero(void *pageaddr, int npages)
 {
-	uint32_t i, j;
-	uint32_t cellmask;
-	uint32_t pagenumber;
-	void *pageaddr;
+	uint32_t count = npages * PAGE_SIZE / sizeof(uint32_t);
+	asm volatile ("cld; rep stosl":"+D" (pageaddr), "+c"(count):"a"(0):"memory");
+}
 
-	if(!freemap) {
+void *page_alloc_order(int order, bool zeroit)
+{
+	int k, block;
+
+	if(!freemap[0]) {
 		printf("memory: not initialized yet!\n");
 		return 0;
 	}
 
-	for(i = 0; i < freemap_cells; i++) {
-		if(freemap[i] != 0) {
-			for(j = 0; j < CELL_BITS; j++) {
-				cellmask = (1 << j);
-				if(freemap[i] & cellmask) {
-					freemap[i] &= ~cellmask;
-					pagenumber = i * CELL_BITS + j;
-					pageaddr = (pagenumber << PAGE_BITS) + main_memory_start;
-					if(zeroit)
-						memset(pageaddr, 0, PAGE_SIZE);
-					pages_free--;
-					return pageaddr;
-				}
-			}
-		}
+	if(order < 0 || order > PAGE_MAX_ORDER)
+		return 0;
+
+	for(k = order; k <= PAGE_MAX_ORDER; k++) {
+		block = block_find(k);
+		if(block >= 0)
+			break;
 	}
 
-	printf("memory: WARNING: everything allocated\n");
-	halt();
+	if(k > PAGE_MAX_ORDER)
+		return 0;
+
+	block_clear(k, block);
+
+	// Split down to the order requested, freeing the upper half each time.
+	while(k > order) {
+		k--;
+		block *= 2;
+		block_set(k, block + 1);
+	}
+
+	void *pageaddr = main_memory_start + ((block << order) << PAGE_BITS);
+	if(zeroit)
+		page_zero(pageaddr, 1 << order);
+	pages_free -= 1 << order;
+
+	return pageaddr;
+}
+
+/* Is this page already free, as part of a free block of this order or above? */
 
+static int page_is_free(uint32_t pagenumber, int order)
+{
+	for(; order <= PAGE_MAX_ORDER; order++) {
+		if(block_test(order, pagenumber >> order))
+			return 1;
+	}
 	return 0;
 }
 
-void page_free(void *pageaddr)
+void page_free_order(void *pageaddr, int order)
+{
+	uint32_t pagenumber = (pageaddr - main_memory_start) >> PAGE_BITS;
+	uint32_t block = pagenumber >> order;
+
+	if(pageaddr < main_memory_start || pagenumber < pages_reserved || pagenumber >= pages_total || (pagenumber & ((1 << order) - 1)) || page_is_free(pagenumber, order)) {
+		printf("memory: invalid page_free(%x)\n", pageaddr);
+		return;
+	}
+
+	pages_free += 1 << order;
+
+	// Merge with the buddy for as long as it is free.
+	while(order < PAGE_MAX_ORDER && (block ^ 1) < (pages_total >> order) && block_test(order, block ^ 1)) {
+		block_clear(order, block ^ 1);
+		block /= 2;
+		order++;
+	}
+
+	block_set(order, block);
+}
+
+void *page_alloc(bool zeroit)
+{
+	void *pageaddr = 0;
+
+	if(zeroit) {
+		if(pool_count > 0) {
+			pool_stats.hits++;
+			return pool[--pool_count];
+		}
+		pool_stats.misses++;
+	}
+
+	pageaddr = page_alloc_order(0, zeroit);
+	if(!pageaddr && pool_count > 0)
+		pageaddr = pool[--pool_count];
+
+	if(!pageaddr && freemap[0]) {
+		printf("memory: WARNING: everything allocated\n");
+		halt();
+	}
+	return pageaddr;
+}
+
+static int page_valid(void *pageaddr)
 {
 	uint32_t pagenumber = (pageaddr - main_memory_start) >> PAGE_BITS;
-	uint32_t cellnumber = pagenumber / CELL_BITS;
-	uint32_t celloffset = pagenumber % CELL_BITS;
-	uint32_t cellmask = (1 << celloffset);
-	freemap[cellnumber] |= cellmask;
-	pages_free++;
+	return pageaddr >= main_memory_start && pagenumber >= pages_reserved && pagenumber < pages_total;
+}
+
+void page_free(void *pageaddr)
+{
+	if(page_valid(pageaddr)) {
+		uint16_t *refs = &page_refs[(pageaddr - main_memory_start) >> PAGE_BITS];
+		if(*refs > 0) {
+			(*refs)--;
+			return;
+		}
+	}
+	page_free_order(pageaddr, 0);
+}
+
+int page_addref(void *pageaddr)
+{
+	if(!page_valid(pageaddr))
+		return 0;
+
+	uint16_t *refs = &page_refs[(pageaddr - main_memory_start) >> PAGE_BITS];
+	if(*refs == PAGE_REFS_MAX)
+		return 0;
+
+	(*refs)++;
+	return 1;
+}
+
+int page_refcount(void *pageaddr)
+{
+	if(!page_valid(pageaddr))
+		return 1;
+	return 1 + page_refs[(pageaddr - main_memory_start) >> PAGE_BITS];
+}
+
+int page_pool_refill()
+{
+	if(pool_count >= PAGE_POOL_SIZE || pages_free < PAGE_POOL_MIN_FREE)
+		return 0;
+
+	void *pageaddr = page_alloc_order(0, 1);
+	if(!pageaddr)
+		return 0;
+
+	pool[pool_count++] = pageaddr;
+	pool_stats.refills++;
+	return 1;
+}
+
+void page_pool_get_stats(struct page_pool_stats *s)
+{
+	*s = pool_stats;
+	s->count = pool_count;
+}
+
+/*
+Time single page allocation as on a system that has been up for a
+while: hold a large number of pages, so that all of low memory is
+in use and the free pages lie far from the start of the bitmap,
+then allocate and free pairs of pages repeatedly.
+*/
+
+#define PAGE_BENCH_HOLD_PAGES 8192
+/* The pointers to the held pages fill exactly a block of this order. */
+#define PAGE_BENCH_HOLD_ORDER 3
+#define PAGE_BENCH_OPERATIONS 100000
+
+int page_bench()
+{
+	void **held = page_alloc_order(PAGE_BENCH_HOLD_ORDER, 0);
+	int nheld = 0, i;
+
+	if(!held)
+		return KERROR_OUT_OF_MEMORY;
+
+	int limit = MIN(PAGE_BENCH_HOLD_PAGES, pages_free / 2);
+	for(nheld = 0; nheld < limit; nheld++) {
+		held[nheld] = page_alloc_order(0, 0);
+		if(!held[nheld])
+			break;
+	}
+
+	clock_t start = clock_read();
+
+	for(i = 0; i < PAGE_BENCH_OPERATIONS; i++) {
+		void *p = page_alloc_order(0, 0);
+		void *q = page_alloc_order(0, 0);
+		if(p)
+			page_free(p);
+		if(q)
+			page_free(q);
+		if(!p || !q)
+			break;
+	}
+
+	clock_t elapsed = clock_diff(start, clock_read());
+
+	printf("memory: %d page allocations with %d pages held in %d ms\n",
+		i * 2, nheld, elapsed.seconds * 1000 + elapsed.millis);
+
+	for(i = 0; i < nheld; i++) {
+		page_free(held[i]);
+	}
+	page_free_order(held, PAGE_BENCH_HOLD_ORDER);
+
+	return 0;
 }
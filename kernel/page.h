@@ -9,9 +9,49 @@ See the file LICENSE for details.
 
 #include "kernel/types.h"
 
+/*
+page_alloc_order returns 2^order physically contiguous pages,
+aligned to their size, or null if there is no such run free.
+They must be given back to page_free_order with the same order.
+*/
+
+#define PAGE_MAX_ORDER 10
+
 void  page_init();
 void *page_alloc(bool zeroit);
 void  page_free(void *addr);
-void  page_stats( uint32_t *nfree, uint32_t *ntotal );
+void *page_alloc_order(int order, bool zeroit);
+void  page_free_order(void *addr, int order);
+
+/*
+page_addref adds an owner to a single page, so that it takes one
+more page_free to release it, and returns false if it cannot.
+page_refcount gives the number of owners, which is normally one.
+*/
+
+int   page_addref(void *addr);
+int   page_refcount(void *addr);
+
+/* If nblocks is not null, it is filled with the free blocks of each order. */
+
+void  page_stats( uint32_t *nfree, uint32_t *ntotal, uint32_t *nblocks );
+
+int   page_bench();
+
+/*
+Zero one more page into the pool of zeroed pages, if it needs one.
+Called by the idle loop, and returns true if it did any work.
+*/
+
+int   page_pool_refill();
+
+struct page_pool_stats {
+	uint32_t count;
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t refills;
+};
+
+void  page_pool_get_stats(struct page_pool_stats *s);
 
 #endif
@@ -8,9 +8,24 @@ See the file LICENSE for details.
 #include "page.h"
 #include "string.h"
 #include "kernelcore.h"
+#include "memorylayout.h"
 
 #define ENTRIES_PER_TABLE (PAGE_SIZE/4)
 
+/* In a directory entry, marks a table that is shared and not owned. */
+#define PAGETABLE_SHARED 0x2
+
+/* In a table entry, marks an allocated page shared copy-on-write. */
+#define PAGEENTRY_COW 0x2
+
+#define LARGE_PAGE_SIZE (PAGE_SIZE*ENTRIES_PER_TABLE)
+
+#define CPUID_FEATURE_PSE (1<<3)
+#define CPUID_FEATURE_PGE (1<<13)
+
+#define CR4_PSE (1<<4)
+#define CR4_PGE (1<<7)
+
 struct pageentry {
 	unsigned present:1;	// 1 = present
 	unsigned readwrite:1;	// 1 = writable
@@ -20,7 +35,7 @@ struct pageentry {
 	unsigned nocache:1;	// 1 = no caching
 	unsigned accessed:1;	// 1 = accessed
 	unsigned dirty:1;	// 1 = dirty
-	unsigned pagesize:1;	// leave to zero
+	unsigned pagesize:1;	// 1 = 4MB page, in a directory entry
 
 	unsigned globalpage:1;	// 1 if not to be flushed
 	unsigned avail:3;
@@ -32,21 +47,110 @@ struct pagetable {
 	struct pageentry entry[ENTRIES_PER_TABLE];
 };
 
+/*
+The kernel half of the address space -- the direct map of physical
+memory, the framebuffer, and the vmalloc range -- is built once, at
+boot, in kernel_pagetable.  Every new address space copies its
+directory entries, and so shares the same second-level tables, so
+that creating a process only allocates tables for user memory, and
+a page mapped by vmalloc is immediately visible to every process.
+*/
+
+static struct pagetable *kernel_pagetable = 0;
+
+/*
+If the processor has them, the direct map and the framebuffer are
+made of 4MB pages, which need no second-level tables and take far
+fewer TLB entries, and kernel pages are global, so that their TLB
+entries survive the reload of %cr3 on every context switch.
+*/
+
+static int large_pages = 0;
+
+static int cpu_has_large_pages()
+{
+	uint32_t eax = 1, ebx, ecx, edx;
+	asm("cpuid":"+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+	return (edx & CPUID_FEATURE_PSE) && (edx & CPUID_FEATURE_PGE);
+}
+
+/*
+Map the physical range [start,stop) into p at the same addresses,
+extended out to 4MB boundaries when large pages are in use.
+*/
+
+static void pagetable_map_direct(struct pagetable *p, unsigned start, unsigned stop)
+{
+	unsigned i;
+
+	if(!large_pages) {
+		for(i = start & ~(PAGE_SIZE - 1); i < stop; i += PAGE_SIZE) {
+			pagetable_map(p, i, i, PAGE_FLAG_KERNEL | PAGE_FLAG_READWRITE);
+		}
+		return;
+	}
+
+	for(i = start & ~(LARGE_PAGE_SIZE - 1); i < stop; i += LARGE_PAGE_SIZE) {
+		struct pageentry *e = &p->entry[i >> 22];
+		if(e->present)
+			continue;
+		e->present = 1;
+		e->readwrite = 1;
+		e->user = 0;
+		e->pagesize = 1;
+		e->globalpage = 1;
+		e->addr = i >> 12;
+		// The address field wraps at 4GB: stop before a range that ends up there.
+		if(i + LARGE_PAGE_SIZE == 0)
+			break;
+	}
+}
+
 struct pagetable *pagetable_create()
 {
 	return page_alloc(1);
 }
 
-void pagetable_init(struct pagetable *p)
+void pagetable_kernel_init()
 {
-	unsigned i, stop;
-	stop = total_memory * 1024 * 1024;
-	for(i = 0; i < stop; i += PAGE_SIZE) {
-		pagetable_map(p, i, i, PAGE_FLAG_KERNEL | PAGE_FLAG_READWRITE);
+	struct pagetable *p = pagetable_create();
+	unsigned i;
+
+	large_pages = cpu_has_large_pages();
+
+	pagetable_map_direct(p, 0, total_memory * 1024 * 1024);
+	pagetable_map_direct(p, (unsigned) video_buffer, (unsigned) video_buffer + video_xres * video_yres * 3);
+
+	// The vmalloc range starts out empty, but its tables must exist to be shared.
+	for(i = KERNEL_VMALLOC_START >> 22; i < KERNEL_VMALLOC_END >> 22; i++) {
+		struct pageentry *e = &p->entry[i];
+		e->present = 1;
+		e->readwrite = 1;
+		e->user = 0;
+		e->addr = (((unsigned) pagetable_create()) >> 12);
 	}
-	stop = (unsigned) video_buffer + video_xres * video_yres * 3;
-	for(i = (unsigned) video_buffer; i <= stop; i += PAGE_SIZE) {
-		pagetable_map(p, i, i, PAGE_FLAG_KERNEL | PAGE_FLAG_READWRITE);
+
+	for(i = 0; i < ENTRIES_PER_TABLE; i++) {
+		if(p->entry[i].present)
+			p->entry[i].avail = PAGETABLE_SHARED;
+	}
+
+	kernel_pagetable = p;
+
+	printf("paging: kernel mapped with %s pages\n", large_pages ? "4MB global" : "4KB");
+}
+
+struct pagetable *pagetable_kernel()
+{
+	return kernel_pagetable;
+}
+
+void pagetable_init(struct pagetable *p)
+{
+	unsigned i;
+	for(i = 0; i < ENTRIES_PER_TABLE; i++) {
+		if(kernel_pagetable->entry[i].present)
+			p->entry[i] = kernel_pagetable->entry[i];
 	}
 }
 
@@ -62,6 +166,13 @@ int pagetable_getmap(struct pagetable *p, unsigned vaddr, unsigned *paddr, int *
 	if(!e->present)
 		return 0;
 
+	if(e->pagesize) {
+		*paddr = (e->addr << 12) + (vaddr & (LARGE_PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+		if(flags)
+			*flags = PAGE_FLAG_KERNEL | PAGE_FLAG_READWRITE;
+		return 1;
+	}
+
 	q = (struct pagetable *) (e->addr << 12);
 
 	e = &q->entry[b];
@@ -91,14 +202,22 @@ int pagetable_map(struct pagetable *p, unsigned vaddr, unsigned paddr, int flags
 	unsigned a = vaddr >> 22;
 	unsigned b = (vaddr >> 12) & 0x3ff;
 
+	e = &p->entry[a];
+
+	// A user page must never land in a table shared by every address space.
+	if(e->present && (e->avail & PAGETABLE_SHARED) && !(flags & PAGE_FLAG_KERNEL))
+		return 0;
+
+	// Nor can a single page be carved out of a 4MB one.
+	if(e->present && e->pagesize)
+		return 0;
+
 	if(flags & PAGE_FLAG_ALLOC) {
 		paddr = (unsigned) page_alloc(flags & PAGE_FLAG_CLEAR);
 		if(!paddr)
 			return 0;
 	}
 
-	e = &p->entry[a];
-
 	if(!e->present) {
 		q = pagetable_create();
 		if(!q)
@@ -145,7 +264,7 @@ void pagetable_unmap(struct pagetable *p, unsigned vaddr)
 	unsigned b = vaddr >> 12 & 0x3ff;
 
 	e = &p->entry[a];
-	if(e->present) {
+	if(e->present && !e->pagesize) {
 		q = (struct pagetable *) (e->addr << 12);
 		e = &q->entry[b];
 		e->present = 0;
@@ -161,7 +280,7 @@ void pagetable_delete(struct pagetable *p)
 
 	for(i = 0; i < ENTRIES_PER_TABLE; i++) {
 		e = &p->entry[i];
-		if(e->present) {
+		if(e->present && !(e->avail & PAGETABLE_SHARED)) {
 			q = (struct pagetable *) (e->addr << 12);
 			for(j = 0; j < ENTRIES_PER_TABLE; j++) {
 				e = &q->entry[j];
@@ -233,13 +352,86 @@ void pagetable_refresh()
 	asm("mov %eax, %cr3");
 }
 
+/*
+Reloading %cr3 keeps global entries, so after changing a kernel
+mapping, flush everything by turning global pages off and on again.
+*/
+
+void pagetable_refresh_global()
+{
+	uint32_t cr4;
+
+	if(!large_pages) {
+		pagetable_refresh();
+		return;
+	}
+
+	asm volatile("mov %%cr4, %0":"=r"(cr4));
+	asm volatile("mov %0, %%cr4"::"r"(cr4 & ~CR4_PGE));
+	asm volatile("mov %0, %%cr4"::"r"(cr4));
+}
+
+/*
+Besides paging, turn on write protection in supervisor mode, so that
+the kernel writing to a read-only page of a mapped file faults too.
+Large and global pages must be enabled before the first 4MB page
+is used, that is, before paging itself.
+*/
+
 void pagetable_enable()
 {
+	if(large_pages) {
+		uint32_t cr4;
+		asm volatile("mov %%cr4, %0":"=r"(cr4));
+		asm volatile("mov %0, %%cr4"::"r"(cr4 | CR4_PSE | CR4_PGE));
+	}
+
 	asm("movl %cr0, %eax");
-	asm("orl $0x80000000, %eax");
+	asm("orl $0x80010000, %eax");
 	asm("movl %eax, %cr0");
 }
 
+/*
+Resolve a write to a page shared copy-on-write: the last owner
+simply makes it writable again, and any other gets its own copy.
+Returns 1 if the fault was handled, and 0 if it was not of this kind.
+*/
+
+int pagetable_cow_fault(struct pagetable *p, unsigned vaddr)
+{
+	struct pagetable *q;
+	struct pageentry *e;
+
+	unsigned a = vaddr >> 22;
+	unsigned b = (vaddr >> 12) & 0x3ff;
+
+	e = &p->entry[a];
+	if(!e->present || e->pagesize)
+		return 0;
+
+	q = (struct pagetable *) (e->addr << 12);
+	e = &q->entry[b];
+	if(!e->present || !(e->avail & PAGEENTRY_COW))
+		return 0;
+
+	void *paddr = (void *) (e->addr << 12);
+
+	if(page_refcount(paddr) > 1) {
+		void *copy = page_alloc(0);
+		if(!copy)
+			return 0;
+		memcpy(copy, paddr, PAGE_SIZE);
+		page_free(paddr);
+		e->addr = ((unsigned) copy) >> 12;
+	}
+
+	e->readwrite = 1;
+	e->avail &= ~PAGEENTRY_COW;
+
+	asm volatile("invlpg (%0)"::"r"(vaddr):"memory");
+	return 1;
+}
+
 struct pagetable *pagetable_duplicate(struct pagetable *sp)
 {
 	unsigned i, j;
@@ -256,7 +448,9 @@ struct pagetable *pagetable_duplicate(struct pagetable *sp)
 	for(i = 0; i < ENTRIES_PER_TABLE; i++) {
 		e = &sp->entry[i];
 		newe = &newp->entry[i];
-		if(e->present) {
+		if(e->present && (e->avail & PAGETABLE_SHARED)) {
+			memcpy(newe, e, sizeof(struct pageentry));
+		} else if(e->present) {
 			q = (struct pagetable *) (e->addr << 12);
 			newq = pagetable_create();
 			if(!newq)
@@ -271,11 +465,21 @@ struct pagetable *pagetable_duplicate(struct pagetable *sp)
 					void *paddr;
 					paddr = (void *) (e->addr << 12);
 					void *new_paddr = 0;
-					if(e->avail) {
+					if(e->avail && page_addref(paddr)) {
+						// Both sides keep the page, read-only until the first write.
+						if(e->readwrite || (e->avail & PAGEENTRY_COW)) {
+							e->readwrite = newe->readwrite = 0;
+							e->avail |= PAGEENTRY_COW;
+							newe->avail |= PAGEENTRY_COW;
+						}
+						new_paddr = paddr;
+					} else if(e->avail) {
 						new_paddr = page_alloc(0);
 						if(!new_paddr)
 							goto cleanup;
 						memcpy(new_paddr, paddr, PAGE_SIZE);
+						newe->avail = e->avail & ~PAGEENTRY_COW;
+						newe->readwrite = e->readwrite || (e->avail & PAGEENTRY_COW);
 					} else {
 						new_paddr = paddr;
 					}
@@ -284,6 +488,8 @@ struct pagetable *pagetable_duplicate(struct pagetable *sp)
 			}
 		}
 	}
+	// The pages of the source that just became read-only may still be writable in the TLB.
+	pagetable_refresh();
 	return newp;
       cleanup:
 	printf("Pagetable duplicate errors\n");
@@ -20,6 +20,8 @@ See the file LICENSE for details.
 
 struct pagetable *pagetable_create();
 void pagetable_init(struct pagetable *p);
+void pagetable_kernel_init();
+struct pagetable *pagetable_kernel();
 int pagetable_map(struct pagetable *p, unsigned vaddr, unsigned paddr, int flags);
 int pagetable_getmap(struct pagetable *p, unsigned vaddr, unsigned *paddr, int *flags);
 void pagetable_unmap(struct pagetable *p, unsigned vaddr);
@@ -27,8 +29,10 @@ void pagetable_alloc(struct pagetable *p, unsigned vaddr, unsigned length, int f
 void pagetable_free(struct pagetable *p, unsigned vaddr, unsigned length);
 void pagetable_delete(struct pagetable *p);
 struct pagetable *pagetable_duplicate(struct pagetable *p);
+int pagetable_cow_fault(struct pagetable *p, unsigned vaddr);
 struct pagetable *pagetable_load(struct pagetable *p);
 void pagetable_enable();
 void pagetable_refresh();
+void pagetable_refresh_global();
 
 #endif
@@ -0,0 +1,264 @@
+/*
+Copyright (C) 2016-2019 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file LICENSE for details.
+*/
+
+#include "pcache.h"
+#include "fs_internal.h"
+#include "list.h"
+#include "page.h"
+#include "kmalloc.h"
+#include "string.h"
+#include "pagetable.h"
+#include "kernel/error.h"
+
+/*
+Each entry holds a reference to the dirent that loaded it, through
+which a dirty page is written back when its last mapping goes away.
+An entry of a removed file is detached: it no longer matches any
+lookup, and is never written back.
+*/
+
+struct pcache_entry {
+	struct list_node node;
+	struct fs_dirent *dirent;
+	struct fs_volume *volume;
+	int inumber;
+	uint32_t pageno;
+	int mapcount;
+	int dirty;
+	int detached;
+	char *data;
+};
+
+static struct list cache = LIST_INIT;
+
+static struct pcache_entry *pcache_writeback_entry = 0;
+
+static struct pcache_entry *pcache_find(struct fs_dirent *d, uint32_t pageno)
+{
+	struct list_node *n;
+
+	for(n = cache.head; n; n = n->next) {
+		struct pcache_entry *e = (struct pcache_entry *) n;
+		if(!e->detached && e->volume == d->volume && e->inumber == d->inumber && e->pageno == pageno)
+			return e;
+	}
+
+	return 0;
+}
+
+static int pcache_writeback(struct pcache_entry *e)
+{
+	uint32_t offset = e->pageno * PAGE_SIZE;
+	struct fs_dirent *d = e->dirent;
+
+	if(e->detached)
+		return 0;
+
+	uint32_t size = fs_dirent_size(d);
+	if(offset >= size)
+		return 0;
+
+	// Don't copy this page back onto itself through pcache_write_update.
+	pcache_writeback_entry = e;
+	int result = fs_dirent_write(d, e->data, MIN(PAGE_SIZE, size - offset), offset);
+	pcache_writeback_entry = 0;
+
+	return result < 0 ? result : 0;
+}
+
+/*
+Find or load page pageno of the file, and count one more mapping of it.
+Returns the page, or null if it lies past the end of the file.
+*/
+
+char *pcache_map(struct fs_dirent *d, uint32_t pageno)
+{
+	struct pcache_entry *e = pcache_find(d, pageno);
+	if(e) {
+		e->mapcount++;
+		return e->data;
+	}
+
+	uint32_t offset = pageno * PAGE_SIZE;
+	uint32_t size = fs_dirent_size(d);
+	if(offset >= size)
+		return 0;
+
+	e = kmalloc(sizeof(*e));
+	if(!e)
+		return 0;
+
+	e->data = page_alloc(1);
+	if(!e->data) {
+		kfree(e);
+		return 0;
+	}
+
+	if(fs_dirent_read(d, e->data, MIN(PAGE_SIZE, size - offset), offset) < 0) {
+		page_free(e->data);
+		kfree(e);
+		return 0;
+	}
+
+	e->dirent = fs_dirent_addref(d);
+	e->volume = d->volume;
+	e->inumber = d->inumber;
+	e->pageno = pageno;
+	e->mapcount = 1;
+	e->dirty = 0;
+	e->detached = 0;
+
+	list_push_head(&cache, &e->node);
+
+	return e->data;
+}
+
+/*
+The pages themselves are unique, so a mapped page is named by its
+address from here on, even if its file has been removed since.
+*/
+
+static struct pcache_entry *pcache_find_data(char *data)
+{
+	struct list_node *n;
+
+	for(n = cache.head; n; n = n->next) {
+		struct pcache_entry *e = (struct pcache_entry *) n;
+		if(e->data == data)
+			return e;
+	}
+
+	return 0;
+}
+
+/* Drop one mapping of a page, and write it back when it was the last. */
+
+void pcache_unmap(char *data)
+{
+	struct pcache_entry *e = pcache_find_data(data);
+	if(!e)
+		return;
+
+	e->mapcount--;
+	if(e->mapcount > 0)
+		return;
+
+	if(e->dirty)
+		pcache_writeback(e);
+
+	list_remove(&e->node);
+	fs_dirent_close(e->dirent);
+	page_free(e->data);
+	kfree(e);
+}
+
+void pcache_addref(char *data)
+{
+	struct pcache_entry *e = pcache_find_data(data);
+	if(e)
+		e->mapcount++;
+}
+
+void pcache_dirty(char *data)
+{
+	struct pcache_entry *e = pcache_find_data(data);
+	if(e && !e->detached)
+		e->dirty = 1;
+}
+
+/*
+Write back the dirty pages of a file.  A page mapped writable may be
+changed again without another fault, so it stays marked dirty until
+its last mapping is gone.
+*/
+
+int pcache_flush(struct fs_dirent *d)
+{
+	struct list_node *n;
+	int result = 0;
+
+	for(n = cache.head; n; n = n->next) {
+		struct pcache_entry *e = (struct pcache_entry *) n;
+		if(e->dirty && !e->detached && e->volume == d->volume && e->inumber == d->inumber) {
+			int r = pcache_writeback(e);
+			if(r < 0)
+				result = r;
+		}
+	}
+
+	return result;
+}
+
+void pcache_invalidate(struct fs_dirent *d)
+{
+	struct list_node *n;
+
+	for(n = cache.head; n; n = n->next) {
+		struct pcache_entry *e = (struct pcache_entry *) n;
+		if(e->volume == d->volume && e->inumber == d->inumber) {
+			e->detached = 1;
+			e->dirty = 0;
+		}
+	}
+}
+
+/*
+Report whether any page of the file is mapped, so that callers
+about to move its blocks can tell that mappings still depend on them.
+*/
+
+int pcache_mapped(struct fs_dirent *d)
+{
+	struct list_node *n;
+
+	for(n = cache.head; n; n = n->next) {
+		struct pcache_entry *e = (struct pcache_entry *) n;
+		if(!e->detached && e->volume == d->volume && e->inumber == d->inumber)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+Copy the overlap between a cached page and a byte range of the file:
+into the page for a write, and out of it for a read.
+*/
+
+static void pcache_overlap(struct fs_dirent *d, char *buffer, uint32_t length, uint32_t offset, int write)
+{
+	struct list_node *n;
+
+	for(n = cache.head; n; n = n->next) {
+		struct pcache_entry *e = (struct pcache_entry *) n;
+		if(e == pcache_writeback_entry || e->detached || e->volume != d->volume || e->inumber != d->inumber)
+			continue;
+
+		uint32_t start = e->pageno * PAGE_SIZE;
+		uint32_t first = MAX(start, offset);
+		uint32_t last = MIN(start + PAGE_SIZE, offset + length);
+		if(first >= last)
+			continue;
+
+		if(write) {
+			memcpy(e->data + first - start, buffer + first - offset, last - first);
+		} else {
+			memcpy(buffer + first - offset, e->data + first - start, last - first);
+		}
+	}
+}
+
+void pcache_read_overlay(struct fs_dirent *d, char *buffer, uint32_t length, uint32_t offset)
+{
+	if(cache.head)
+		pcache_overlap(d, buffer, length, offset, 0);
+}
+
+void pcache_write_update(struct fs_dirent *d, const char *buffer, uint32_t length, uint32_t offset)
+{
+	if(cache.head)
+		pcache_overlap(d, (char *) buffer, length, offset, 1);
+}
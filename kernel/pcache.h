@@ -0,0 +1,34 @@
+/*
+Copyright (C) 2016-2019 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file LICENSE for details.
+*/
+
+#ifndef PCACHE_H
+#define PCACHE_H
+
+#include "kernel/types.h"
+#include "fs.h"
+
+/*
+The page cache holds whole pages of files, indexed by volume, inode
+and page number, so that every process mapping the same part of a
+file shares one physical page.  A page stays in the cache only while
+it is mapped somewhere.
+*/
+
+char *pcache_map(struct fs_dirent *d, uint32_t pageno);
+void  pcache_addref(char *data);
+void  pcache_unmap(char *data);
+void  pcache_dirty(char *data);
+
+int   pcache_flush(struct fs_dirent *d);
+void  pcache_invalidate(struct fs_dirent *d);
+int   pcache_mapped(struct fs_dirent *d);
+
+/* Keep mapped pages and ordinary reads and writes of a file in step. */
+
+void  pcache_read_overlay(struct fs_dirent *d, char *buffer, uint32_t length, uint32_t offset);
+void  pcache_write_update(struct fs_dirent *d, const char *buffer, uint32_t length, uint32_t offset);
+
+#endif
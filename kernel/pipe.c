@@ -6,9 +6,9 @@ See the file LICENSE for details.
 
 #include "kernel/types.h"
 #include "pipe.h"
-#include "kmalloc.h"
 #include "process.h"
 #include "list.h"
+#include "slab.h"
 
 #define PIPE_SIZE (1024)
 
@@ -22,10 +22,18 @@ struct pipe {
 	struct list queue;
 };
 
+static struct slab_cache pipe_cache = SLAB_CACHE_INIT("pipe", sizeof(struct pipe), 0);
+static struct slab_cache buffer_cache = SLAB_CACHE_INIT("pipe_buffer", PIPE_SIZE, 0);
+
 struct pipe *pipe_create()
 {
-	struct pipe *p = kmalloc(sizeof(*p));
-	p->buffer = kmalloc(PIPE_SIZE * sizeof(char));
+	struct pipe *p = slab_alloc(&pipe_cache);
+	if(!p) return 0;
+	p->buffer = slab_alloc(&buffer_cache);
+	if(!p->buffer) {
+		slab_free(&pipe_cache, p);
+		return 0;
+	}
 	p->read_pos = 0;
 	p->write_pos = 0;
 	p->blocking = 1;
@@ -56,9 +64,9 @@ void pipe_delete(struct pipe *p)
 	p->refcount--;
 	if(p->refcount==0) {
 		if(p->buffer) {
-			kfree(p->buffer);
+			slab_free(&buffer_cache, p->buffer);
 		}
-		kfree(p);
+		slab_free(&pipe_cache, p);
 	}
 }
 
@@ -16,10 +16,13 @@ See the file LICENSE for details.
 #include "memorylayout.h"
 #include "kmalloc.h"
 #include "kernel/types.h"
+#include "kernel/error.h"
 #include "kernelcore.h"
 #include "main.h"
 #include "keyboard.h"
 #include "clock.h"
+#include "mmap.h"
+#include "diskfs.h"
 
 struct process *current = 0;
 struct list ready_list = { 0, 0 };
@@ -154,25 +157,22 @@ void process_inherit(struct process *parent, struct process *child)
 
 int process_data_size_set(struct process *p, unsigned size)
 {
-	// XXX check valid ranges
-	// XXX round up to page size
+	// The heap must stay below the area where files are mapped.
+	if(size > PROCESS_MMAP_START - PROCESS_ENTRY_POINT)
+		return KERROR_OUT_OF_MEMORY;
 
 	if(size % PAGE_SIZE) {
 		size += (PAGE_SIZE - size % PAGE_SIZE);
 	}
 
-	if(size > p->vm_data_size) {
-		uint32_t start = PROCESS_ENTRY_POINT + p->vm_data_size;
-		pagetable_alloc(p->pagetable, start, size, PAGE_FLAG_USER | PAGE_FLAG_READWRITE | PAGE_FLAG_CLEAR);
-	} else if(size < p->vm_data_size) {
+	// Growing only reserves the space: pages are mapped on first touch.
+	if(size < p->vm_data_size) {
 		uint32_t start = PROCESS_ENTRY_POINT + size;
-		pagetable_free(p->pagetable, start, p->vm_data_size);
-	} else {
-		// requested size is equal to current.
+		pagetable_free(p->pagetable, start, p->vm_data_size - size);
+		pagetable_refresh();
 	}
 
 	p->vm_data_size = size;
-	pagetable_refresh();
 
 	return 0;
 }
@@ -182,24 +182,56 @@ int process_stack_size_set(struct process *p, unsigned size)
 	// XXX check valid ranges
 	// XXX round up to page size
 
-	if(size > p->vm_stack_size) {
-		uint32_t start = -size;
-		pagetable_alloc(p->pagetable, start, size - p->vm_stack_size, PAGE_FLAG_USER | PAGE_FLAG_READWRITE | PAGE_FLAG_CLEAR);
-	} else {
+	if(size < p->vm_stack_size) {
 		uint32_t start = -p->vm_stack_size;
 		pagetable_free(p->pagetable, start, p->vm_stack_size - size);
+		pagetable_refresh();
 	}
 
 	p->vm_stack_size = size;
-	pagetable_refresh();
 
 	return 0;
 }
 
 void process_stack_reset(struct process *p, unsigned size)
 {
+	// Drop the old stack entirely, so that the new one starts out zeroed.
+	process_stack_size_set(p, 0);
 	process_stack_size_set(p, size);
-	memset((void *) -size, size, 0);
+
+	// The arguments are written here at once, perhaps by another process, so map it now.
+	pagetable_alloc(p->pagetable, -size, size, PAGE_FLAG_USER | PAGE_FLAG_READWRITE | PAGE_FLAG_CLEAR);
+}
+
+/*
+The data and stack of a process are only reserved up front, and each
+page is mapped to a zeroed page when it is first touched.  An access
+below the stack grows the stack, as far down as the end of the mmap
+area, if it is within 128 bytes of the stack pointer: a push, call
+or pusha faults before it moves esp, so its write lands just below.
+Returns 1 if the fault was resolved, and 0 if the access is not allowed.
+*/
+
+int process_memory_fault(struct process *p, uint32_t vaddr, uint32_t esp)
+{
+	uint32_t page = vaddr & ~(PAGE_SIZE - 1);
+	unsigned paddr;
+
+	// A fault on a page that is present is a protection violation.
+	if(pagetable_getmap(p->pagetable, page, &paddr, 0))
+		return 0;
+
+	if(vaddr >= PROCESS_ENTRY_POINT && vaddr < PROCESS_ENTRY_POINT + p->vm_data_size) {
+		// within the heap
+	} else if(p->vm_stack_size > 0 && vaddr >= -p->vm_stack_size) {
+		// within the stack
+	} else if(vaddr >= PROCESS_MMAP_END && vaddr >= esp - 128) {
+		p->vm_stack_size = -page;
+	} else {
+		return 0;
+	}
+
+	return pagetable_map(p->pagetable, page, 0, PAGE_FLAG_USER | PAGE_FLAG_READWRITE | PAGE_FLAG_ALLOC | PAGE_FLAG_CLEAR);
 }
 
 struct process *process_create()
@@ -216,6 +248,7 @@ struct process *process_create()
 
 	p->vm_data_size = 0;
 	p->vm_stack_size = 0;
+	p->vm_mmap_next = PROCESS_MMAP_START;
 
 	process_data_size_set(p, 2 * PAGE_SIZE);
 	process_stack_size_set(p, 2 * PAGE_SIZE);
@@ -247,14 +280,27 @@ void process_delete(struct process *p)
 	}
 	fs_dirent_close(p->current_dir);
 	fs_dirent_close(p->root_dir);
+	mmap_delete_all(p);
 	pagetable_delete(p->pagetable);
 	page_free(p->kstack);
 	page_free(p);
 	process_table[p->pid] = 0;
 }
 
+/*
+Report the time from boot until the first user program is
+launched, which is mostly spent loading the root filesystem.
+*/
+
+static int process_launched = 0;
+
 void process_launch(struct process *p)
 {
+	if(!process_launched) {
+		clock_t elapsed = clock_read();
+		printf("boot: first program launched %d.%03d seconds after boot\n", elapsed.seconds, elapsed.millis);
+		process_launched = 1;
+	}
 	list_push_tail(&ready_list, &p->node);
 }
 
@@ -292,6 +338,13 @@ static void process_switch(int newstate)
 		if(current)
 			break;
 
+		// Use idle time to commit old transactions and zero a page, letting any interrupt in before looking again.
+		if(diskfs_journal_commit_expired() || page_pool_refill()) {
+			interrupt_unblock();
+			interrupt_block();
+			continue;
+		}
+
 		interrupt_unblock();
 		interrupt_wait();
 		interrupt_block();
@@ -44,6 +44,8 @@ struct process {
 	uint32_t ppid;
 	uint32_t vm_data_size;
 	uint32_t vm_stack_size;
+	uint32_t vm_mmap_next;
+	struct list mmap_list;
 	uint32_t waiting_for_child_pid;
 };
 
@@ -62,6 +64,7 @@ void process_kstack_copy(struct process *parent, struct process *child);
 
 int process_data_size_set(struct process *p, unsigned size);
 int process_stack_size_set(struct process *p, unsigned size);
+int process_memory_fault(struct process *p, uint32_t vaddr, uint32_t esp);
 
 int process_available_fd(struct process *p);
 int process_object_max(struct process *p);
@@ -0,0 +1,190 @@
+/*
+Copyright (C) 2016-2019 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file LICENSE for details.
+*/
+
+#include "slab.h"
+#include "page.h"
+#include "console.h"
+#include "kernel/types.h"
+
+/*
+Keep at most this many empty slabs in a cache, so that a burst
+of frees doesn't cost a page_free and page_alloc on every cycle,
+but a cache that shrinks still gives its pages back.
+*/
+
+#define SLAB_EMPTY_MAX 1
+
+#define SLAB_ALIGN sizeof(void*)
+
+struct slab {
+	struct list_node node;
+	struct slab_cache *cache;
+	void *freelist;
+	int inuse;
+};
+
+#define SLAB_HEADER ((sizeof(struct slab) + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1))
+
+#define SLAB_LINK(c,object) (*(void **) ((char *) (object) + ((c)->ctor ? (c)->size : 0)))
+
+static struct slab_cache *caches = 0;
+
+static void slab_cache_setup(struct slab_cache *c)
+{
+	if(c->size < SLAB_ALIGN)
+		c->size = SLAB_ALIGN;
+	c->size = (c->size + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1);
+
+	// A constructed object must survive on the free list, so keep its link just past it.
+	c->stride = c->ctor ? c->size + SLAB_ALIGN : c->size;
+
+	c->objects_per_slab = (PAGE_SIZE - SLAB_HEADER) / c->stride;
+	if(c->objects_per_slab < 1) {
+		printf("slab: %s objects of %d bytes don't fit in a page!\n", c->name, c->size);
+		c->objects_per_slab = -1;
+		return;
+	}
+
+	c->next = caches;
+	caches = c;
+}
+
+/*
+Carve a fresh page into objects, threading the free list
+through them in address order, and constructing each one.
+*/
+
+static struct slab *slab_create(struct slab_cache *c)
+{
+	struct slab *s = page_alloc(0);
+	if(!s)
+		return 0;
+
+	s->node.next = s->node.prev = 0;
+	s->node.list = 0;
+	s->cache = c;
+	s->inuse = 0;
+	s->freelist = 0;
+
+	char *base = (char *) s + SLAB_HEADER;
+	int i;
+
+	for(i = c->objects_per_slab - 1; i >= 0; i--) {
+		void *object = base + i * c->stride;
+		if(c->ctor)
+			c->ctor(object);
+		SLAB_LINK(c, object) = s->freelist;
+		s->freelist = object;
+	}
+
+	c->slabs++;
+	return s;
+}
+
+static void slab_delete(struct slab *s)
+{
+	s->cache->slabs--;
+	page_free(s);
+}
+
+void *slab_alloc(struct slab_cache *c)
+{
+	struct slab *s;
+
+	if(c->objects_per_slab == 0)
+		slab_cache_setup(c);
+	if(c->objects_per_slab < 0)
+		return 0;
+
+	c->allocs++;
+
+	if(c->partial.head) {
+		s = (struct slab *) c->partial.head;
+		c->hits++;
+	} else if(c->empty.head) {
+		s = (struct slab *) list_pop_head(&c->empty);
+		list_push_head(&c->partial, &s->node);
+		c->hits++;
+	} else {
+		s = slab_create(c);
+		if(!s) {
+			printf("slab: %s: out of memory!\n", c->name);
+			return 0;
+		}
+		list_push_head(&c->partial, &s->node);
+	}
+
+	void *object = s->freelist;
+	s->freelist = SLAB_LINK(c, object);
+	s->inuse++;
+	c->active++;
+
+	if(s->inuse == c->objects_per_slab) {
+		list_remove(&s->node);
+		list_push_head(&c->full, &s->node);
+	}
+
+	return object;
+}
+
+void slab_free(struct slab_cache *c, void *object)
+{
+	if(!object)
+		return;
+
+	struct slab *s = (struct slab *) ((uint32_t) object & ~(PAGE_SIZE - 1));
+
+	if(s->cache != c || ((char *) object - (char *) s - SLAB_HEADER) % c->stride) {
+		printf("slab: invalid free of %x to %s\n", object, c->name);
+		return;
+	}
+
+	SLAB_LINK(c, object) = s->freelist;
+	s->freelist = object;
+	s->inuse--;
+	c->active--;
+	c->frees++;
+
+	if(s->inuse == c->objects_per_slab - 1) {
+		// The slab was full, and now has room.
+		list_remove(&s->node);
+		list_push_head(&c->partial, &s->node);
+	}
+
+	if(s->inuse == 0) {
+		list_remove(&s->node);
+		if(list_size(&c->empty) < SLAB_EMPTY_MAX) {
+			list_push_head(&c->empty, &s->node);
+		} else {
+			slab_delete(s);
+		}
+	}
+}
+
+int slab_get_stats(int n, struct slab_stats *s)
+{
+	struct slab_cache *c;
+
+	for(c = caches; c && n > 0; c = c->next)
+		n--;
+
+	if(!c)
+		return 0;
+
+	s->name = c->name;
+	s->size = c->size;
+	s->objects_per_slab = c->objects_per_slab;
+	s->active = c->active;
+	s->slabs = c->slabs;
+	s->partial = list_size(&c->partial);
+	s->full = list_size(&c->full);
+	s->empty = list_size(&c->empty);
+	s->allocs = c->allocs;
+	s->hits = c->hits;
+	s->frees = c->frees;
+
+	return 1;
+}
@@ -0,0 +1,71 @@
+/*
+Copyright (C) 2016-2019 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file LICENSE for details.
+*/
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "kernel/types.h"
+#include "list.h"
+
+/*
+A slab cache hands out objects of a single size, carved out of
+whole pages obtained from page_alloc.  Each page (a slab) begins
+with a small header and a free list threaded through its unused
+objects, so allocating and freeing are constant time, and never
+touch the kmalloc list.  Slabs move between the partial, full
+and empty lists of the cache as objects come and go.
+
+If a constructor is given, it is applied to each object once,
+when its slab is created, and the object must be returned to
+the cache in that same constructed state.
+
+A cache is declared statically with SLAB_CACHE_INIT, and sets
+itself up on the first allocation.
+*/
+
+struct slab_cache {
+	const char *name;
+	int size;
+	void (*ctor) (void *object);
+
+	int stride;
+	int objects_per_slab;
+	struct list partial;
+	struct list full;
+	struct list empty;
+	struct slab_cache *next;
+
+	uint32_t active;
+	uint32_t slabs;
+	uint32_t allocs;
+	uint32_t hits;
+	uint32_t frees;
+};
+
+#define SLAB_CACHE_INIT(name,size,ctor) { name, size, ctor }
+
+void *slab_alloc(struct slab_cache *c);
+void  slab_free(struct slab_cache *c, void *object);
+
+struct slab_stats {
+	const char *name;
+	uint32_t size;
+	uint32_t objects_per_slab;
+	uint32_t active;
+	uint32_t slabs;
+	uint32_t partial;
+	uint32_t full;
+	uint32_t empty;
+	uint32_t allocs;
+	uint32_t hits;
+	uint32_t frees;
+};
+
+/* Fill in the stats of the nth cache in use, returning zero past the last one. */
+
+int slab_get_stats(int n, struct slab_stats *s);
+
+#endif
@@ -210,6 +210,20 @@ void memcpy(void *vd, const void *vs, unsigned length)
 	}
 }
 
+int memcmp(const void *va, const void *vb, unsigned length)
+{
+	const unsigned char *a = va;
+	const unsigned char *b = vb;
+	while(length) {
+		if(*a != *b)
+			return *a - *b;
+		a++;
+		b++;
+		length--;
+	}
+	return 0;
+}
+
 char *uint_to_string(uint32_t u, char *s)
 {
 	uint32_t f, d, i;
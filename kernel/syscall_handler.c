@@ -28,6 +28,9 @@ See the file LICENSE for details.
 #include "graphics.h"
 #include "is_valid.h"
 #include "bcache.h"
+#include "diskfs.h"
+#include "io_ring.h"
+#include "mmap.h"
 
 /*
 syscall_handler() is responsible for decoding system calls
@@ -219,6 +222,9 @@ int sys_process_exec(const char *path, int argc, const char **argv)
 		return r;
 	}
 
+	/* The old program's file mappings go with it. */
+	mmap_delete_all(current);
+
 	/* Reset the stack and pass in the program arguments */
 	process_stack_reset(current, PAGE_SIZE);
 	process_kstack_reset(current, entry);
@@ -246,6 +252,9 @@ int sys_process_fork()
 	p->ppid = current->pid;
 	pagetable_delete(p->pagetable);
 	p->pagetable = pagetable_duplicate(current->pagetable);
+	p->vm_data_size = current->vm_data_size;
+	p->vm_stack_size = current->vm_stack_size;
+	mmap_inherit(current, p);
 	process_inherit(current, p);
 	process_kstack_copy(current, p);
 	process_launch(p);
@@ -292,7 +301,13 @@ int sys_process_stats(struct process_stats *s, int pid)
 
 int sys_process_heap(int delta)
 {
-	process_data_size_set(current, current->vm_data_size + delta);
+	if(delta < 0 && (uint32_t) 0 - (uint32_t) delta > current->vm_data_size)
+		return KERROR_INVALID_REQUEST;
+
+	int result = process_data_size_set(current, current->vm_data_size + delta);
+	if(result < 0)
+		return result;
+
 	return PROCESS_ENTRY_POINT + current->vm_data_size;
 }
 
@@ -304,6 +319,41 @@ int sys_object_list( int fd, char *buffer, int length)
 	return kobject_read(current->ktable[fd],buffer,length);
 }
 
+int sys_object_sync( int fd, int datasync )
+{
+	if(!is_valid_object(fd)) return KERROR_INVALID_OBJECT;
+	return kobject_sync(current->ktable[fd],datasync);
+}
+
+int sys_object_extents( int fd, struct fs_extent_stats *s )
+{
+	if(!is_valid_object(fd)) return KERROR_INVALID_OBJECT;
+	if(!is_valid_pointer(s,sizeof(*s))) return KERROR_INVALID_ADDRESS;
+	return kobject_extents(current->ktable[fd],s);
+}
+
+int sys_object_defrag( int fd )
+{
+	if(!is_valid_object(fd)) return KERROR_INVALID_OBJECT;
+	return kobject_defrag(current->ktable[fd]);
+}
+
+int sys_object_transfer( int src, int dst, int length )
+{
+	if(!is_valid_object(src)) return KERROR_INVALID_OBJECT;
+	if(!is_valid_object(dst)) return KERROR_INVALID_OBJECT;
+	return kobject_transfer(current->ktable[src],current->ktable[dst],length);
+}
+
+int sys_object_readdir( int fd, char *buffer, int length, uint32_t *cookie )
+{
+	if(!is_valid_object(fd)) return KERROR_INVALID_OBJECT;
+	if(!is_valid_pointer(buffer,length)) return KERROR_INVALID_ADDRESS;
+	if(!is_valid_pointer(cookie,sizeof(*cookie))) return KERROR_INVALID_ADDRESS;
+	if(kobject_get_type(current->ktable[fd])!=KOBJECT_DIR) return KERROR_NOT_A_DIRECTORY;
+	return kobject_readdir(current->ktable[fd],buffer,length,cookie);
+}
+
 int sys_open_file_relative( int fd, const char *path, int mode, kernel_flags_t flags)
 {
 	if(!is_valid_object(fd)) return KERROR_INVALID_OBJECT;
@@ -361,8 +411,9 @@ int sys_open_file(const char *path, int mode, kernel_flags_t flags)
 	if(newfd<0) return KERROR_OUT_OF_OBJECTS;
 
 	struct fs_dirent *d = fs_resolve(path);
+	if(!d && (flags&KERNEL_FLAGS_CREATE)) d = fs_resolve_mkfile(path);
 
-	if(fs_dirent_isdir(d)) {
+	if(d && fs_dirent_isdir(d)) {
 		fs_dirent_close(d);
 		return KERROR_NOT_A_FILE;
 	}
@@ -480,12 +531,58 @@ int sys_object_write(int fd, void *data, int length)
 	return kobject_write(p, data, length);
 }
 
+int sys_object_readv(int fd, struct iovec *iov, int count)
+{
+	if(!is_valid_object(fd)) return KERROR_INVALID_OBJECT;
+	if(!is_valid_iovec(iov,count)) return KERROR_INVALID_ADDRESS;
+	return kobject_readv(current->ktable[fd], iov, count);
+}
+
+int sys_object_writev(int fd, struct iovec *iov, int count)
+{
+	if(!is_valid_object(fd)) return KERROR_INVALID_OBJECT;
+	if(!is_valid_iovec(iov,count)) return KERROR_INVALID_ADDRESS;
+	return kobject_writev(current->ktable[fd], iov, count);
+}
+
+int sys_io_ring_enter(struct io_ring *ring, int to_submit, int min_complete)
+{
+	if(!is_valid_pointer(ring,sizeof(*ring))) return KERROR_INVALID_ADDRESS;
+	return io_ring_enter(ring, to_submit, min_complete);
+}
+
+int sys_object_mmap(int fd, int offset, int length, int flags, uint32_t *addr)
+{
+	if(!is_valid_object_type(fd,KOBJECT_FILE)) return KERROR_INVALID_OBJECT;
+	if(!is_valid_pointer(addr,sizeof(*addr))) return KERROR_INVALID_ADDRESS;
+	if(offset<0 || length<=0) return KERROR_INVALID_REQUEST;
+	return mmap_create(current, current->ktable[fd]->data.file, offset, length, flags, addr);
+}
+
+int sys_process_munmap(uint32_t addr)
+{
+	return mmap_delete(current, addr);
+}
+
 int sys_object_seek(int fd, int offset, int whence)
 {
 	if(!is_valid_object(fd)) return KERROR_INVALID_OBJECT;
 
-	// XXX add kobject method here
-	return KERROR_NOT_IMPLEMENTED;
+	return kobject_seek(current->ktable[fd], offset, whence);
+}
+
+int sys_object_pread(int fd, void *data, int length, int offset)
+{
+	if(!is_valid_object(fd)) return KERROR_INVALID_OBJECT;
+	if(!is_valid_pointer(data,length)) return KERROR_INVALID_ADDRESS;
+	return kobject_pread(current->ktable[fd], data, length, offset);
+}
+
+int sys_object_pwrite(int fd, void *data, int length, int offset)
+{
+	if(!is_valid_object(fd)) return KERROR_INVALID_OBJECT;
+	if(!is_valid_pointer(data,length)) return KERROR_INVALID_ADDRESS;
+	return kobject_pwrite(current->ktable[fd], data, length, offset);
 }
 
 int sys_object_remove( int fd, const char *name )
@@ -575,6 +672,7 @@ int sys_bcache_stats(struct bcache_stats * s)
 
 int sys_bcache_flush()
 {
+	diskfs_journal_commit_all();
 	bcache_flush_all();
 	return 0;
 }
@@ -677,6 +775,32 @@ int32_t syscall_handler(syscall_t n, uint32_t a, uint32_t b, uint32_t c, uint32_
 		return sys_object_read_nonblock(a, (void *) b, c);
 	case SYSCALL_OBJECT_LIST:
 		return sys_object_list(a, (char *) b, (int) c);
+	case SYSCALL_OBJECT_FSYNC:
+		return sys_object_sync(a, 0);
+	case SYSCALL_OBJECT_FDATASYNC:
+		return sys_object_sync(a, 1);
+	case SYSCALL_OBJECT_EXTENTS:
+		return sys_object_extents(a, (struct fs_extent_stats *) b);
+	case SYSCALL_OBJECT_DEFRAG:
+		return sys_object_defrag(a);
+	case SYSCALL_OBJECT_TRANSFER:
+		return sys_object_transfer(a, b, c);
+	case SYSCALL_OBJECT_PREAD:
+		return sys_object_pread(a, (void *) b, c, d);
+	case SYSCALL_OBJECT_PWRITE:
+		return sys_object_pwrite(a, (void *) b, c, d);
+	case SYSCALL_OBJECT_READV:
+		return sys_object_readv(a, (struct iovec *) b, c);
+	case SYSCALL_OBJECT_WRITEV:
+		return sys_object_writev(a, (struct iovec *) b, c);
+	case SYSCALL_IO_RING_ENTER:
+		return sys_io_ring_enter((struct io_ring *) a, b, c);
+	case SYSCALL_OBJECT_MMAP:
+		return sys_object_mmap(a, b, c, d, (uint32_t *) e);
+	case SYSCALL_PROCESS_MUNMAP:
+		return sys_process_munmap(a);
+	case SYSCALL_OBJECT_READDIR:
+		return sys_object_readdir(a, (char *) b, (int) c, (uint32_t *) d);
 	case SYSCALL_OBJECT_WRITE:
 		return sys_object_write(a, (void *) b, c);
 	case SYSCALL_OBJECT_SEEK:
@@ -0,0 +1,471 @@
+/*
+Copyright (C) 2016-2019 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file LICENSE for details.
+*/
+
+#include "kernel/types.h"
+#include "kernel/error.h"
+#include "kmalloc.h"
+#include "tmpfs.h"
+#include "string.h"
+#include "fs.h"
+#include "fs_internal.h"
+#include "page.h"
+
+/*
+A node is a file or directory, and lives as long as it is linked
+into a directory or held open by a dirent.  A directory is a list
+of items, each naming a child node.  New items are appended, so the
+list is in order of increasing inode number, which readdir uses
+as a cookie that stays valid while items are removed.  The parent
+of a node is cleared when it is unlinked, so that nothing new can
+be created inside of a directory that has already been removed.
+*/
+
+struct tmpfs_item {
+	char *name;
+	struct tmpfs_node *node;
+	struct tmpfs_item *next;
+};
+
+struct tmpfs_node {
+	int isdir;
+	int inumber;
+	int refcount;
+	uint32_t size;
+	char **pages;
+	struct tmpfs_item *items;
+	struct tmpfs_node *parent;
+};
+
+static uint32_t pages_used = 0;
+static uint32_t pages_max = 0;
+static uint32_t nodes = 0;
+static int next_inumber = 1;
+
+static char *tmpfs_page_alloc()
+{
+	if(pages_used >= pages_max)
+		return 0;
+
+	char *p = page_alloc(1);
+	if(p)
+		pages_used++;
+	return p;
+}
+
+static void tmpfs_page_free(char *p)
+{
+	page_free(p);
+	pages_used--;
+}
+
+static struct tmpfs_node *tmpfs_node_create(int isdir, struct tmpfs_node *parent)
+{
+	struct tmpfs_node *n = kmalloc(sizeof(*n));
+	if(!n)
+		return 0;
+
+	memset(n, 0, sizeof(*n));
+	n->isdir = isdir;
+	n->inumber = next_inumber++;
+	n->refcount = 1;
+	n->parent = parent ? parent : n;
+	nodes++;
+
+	return n;
+}
+
+/* Free the data pages of a file, starting with page first. */
+
+static void tmpfs_node_truncate(struct tmpfs_node *n, uint32_t first)
+{
+	uint32_t i;
+
+	if(!n->pages)
+		return;
+
+	for(i = first; i < TMPFS_MAX_FILE_PAGES; i++) {
+		if(n->pages[i]) {
+			tmpfs_page_free(n->pages[i]);
+			n->pages[i] = 0;
+		}
+	}
+
+	if(first == 0) {
+		tmpfs_page_free((char *) n->pages);
+		n->pages = 0;
+	}
+}
+
+static void tmpfs_node_release(struct tmpfs_node *n)
+{
+	n->refcount--;
+	if(n->refcount > 0)
+		return;
+
+	while(n->items) {
+		struct tmpfs_item *i = n->items;
+		n->items = i->next;
+		tmpfs_node_release(i->node);
+		kfree(i->name);
+		kfree(i);
+	}
+
+	tmpfs_node_truncate(n, 0);
+	kfree(n);
+	nodes--;
+}
+
+static struct fs_dirent *tmpfs_dirent_create(struct fs_volume *v, struct tmpfs_node *n)
+{
+	struct fs_dirent *d = fs_dirent_alloc();
+	if(!d)
+		return 0;
+
+	d->volume = v;
+	d->refcount = 1;
+	d->inumber = n->inumber;
+	d->size = n->size;
+	d->isdir = n->isdir;
+	d->tmp.node = n;
+	n->refcount++;
+
+	return d;
+}
+
+static struct tmpfs_item *tmpfs_item_find(struct tmpfs_node *n, const char *name)
+{
+	struct tmpfs_item *i;
+
+	for(i = n->items; i; i = i->next) {
+		if(!strcmp(i->name, name))
+			return i;
+	}
+
+	return 0;
+}
+
+static struct fs_dirent *tmpfs_dirent_lookup(struct fs_dirent *d, const char *name)
+{
+	struct tmpfs_node *n = d->tmp.node;
+
+	if(!n->isdir)
+		return 0;
+
+	if(!strcmp(name, "..")) {
+		if(!n->parent)
+			return 0;
+		return tmpfs_dirent_create(d->volume, n->parent);
+	}
+
+	struct tmpfs_item *i = tmpfs_item_find(n, name);
+	if(!i)
+		return 0;
+
+	return tmpfs_dirent_create(d->volume, i->node);
+}
+
+static struct fs_dirent *tmpfs_dirent_create_file_or_dir(struct fs_dirent *d, const char *name, int isdir)
+{
+	struct tmpfs_node *n = d->tmp.node;
+
+	if(!n->isdir || !n->parent)
+		return 0;
+	if(!name[0] || strchr(name, '/') || !strcmp(name, ".") || !strcmp(name, ".."))
+		return 0;
+	if(tmpfs_item_find(n, name))
+		return 0;
+
+	struct tmpfs_item *i = kmalloc(sizeof(*i));
+	if(!i)
+		return 0;
+
+	i->name = strdup(name);
+	i->node = tmpfs_node_create(isdir, n);
+	if(!i->name || !i->node) {
+		if(i->name)
+			kfree(i->name);
+		if(i->node)
+			tmpfs_node_release(i->node);
+		kfree(i);
+		return 0;
+	}
+
+	struct tmpfs_item **p = &n->items;
+	while(*p)
+		p = &(*p)->next;
+	i->next = 0;
+	*p = i;
+
+	return tmpfs_dirent_create(d->volume, i->node);
+}
+
+static struct fs_dirent *tmpfs_dirent_mkdir(struct fs_dirent *d, const char *name)
+{
+	return tmpfs_dirent_create_file_or_dir(d, name, 1);
+}
+
+static struct fs_dirent *tmpfs_dirent_mkfile(struct fs_dirent *d, const char *name)
+{
+	return tmpfs_dirent_create_file_or_dir(d, name, 0);
+}
+
+static int tmpfs_dirent_read_block(struct fs_dirent *d, char *buffer, uint32_t blocknum)
+{
+	struct tmpfs_node *n = d->tmp.node;
+
+	if(n->isdir)
+		return KERROR_NOT_A_FILE;
+	if(blocknum >= TMPFS_MAX_FILE_PAGES)
+		return KERROR_INVALID_REQUEST;
+
+	// Pages that were never written read back as zeros.
+	if(n->pages && n->pages[blocknum]) {
+		memcpy(buffer, n->pages[blocknum], PAGE_SIZE);
+	} else {
+		memset(buffer, 0, PAGE_SIZE);
+	}
+
+	return PAGE_SIZE;
+}
+
+static int tmpfs_dirent_write_block(struct fs_dirent *d, const char *buffer, uint32_t blocknum)
+{
+	struct tmpfs_node *n = d->tmp.node;
+
+	if(n->isdir)
+		return KERROR_NOT_A_FILE;
+	if(blocknum >= TMPFS_MAX_FILE_PAGES)
+		return KERROR_OUT_OF_SPACE;
+
+	if(!n->pages) {
+		n->pages = (char **) tmpfs_page_alloc();
+		if(!n->pages)
+			return KERROR_OUT_OF_SPACE;
+	}
+
+	if(!n->pages[blocknum]) {
+		n->pages[blocknum] = tmpfs_page_alloc();
+		if(!n->pages[blocknum])
+			return KERROR_OUT_OF_SPACE;
+	}
+
+	memcpy(n->pages[blocknum], buffer, PAGE_SIZE);
+	return PAGE_SIZE;
+}
+
+static int tmpfs_dirent_list(struct fs_dirent *d, char *buffer, int buffer_length)
+{
+	struct tmpfs_node *n = d->tmp.node;
+	struct tmpfs_item *i;
+	int total = 0;
+
+	if(!n->isdir)
+		return KERROR_NOT_A_DIRECTORY;
+
+	const char *dots[] = { ".", ".." };
+	int j;
+
+	for(j = 0; j < 2; j++) {
+		if(buffer_length < 2 + j)
+			return total;
+		strcpy(buffer, dots[j]);
+		buffer += 2 + j;
+		buffer_length -= 2 + j;
+		total += 2 + j;
+	}
+
+	for(i = n->items; i; i = i->next) {
+		int length = strlen(i->name) + 1;
+		if(length > buffer_length)
+			break;
+		strcpy(buffer, i->name);
+		buffer += length;
+		buffer_length -= length;
+		total += length;
+	}
+
+	return total;
+}
+
+/*
+Cookies zero and one stand for "." and "..", after which the
+cookie is the lowest inode number not yet returned.  Every child
+has a higher inode number than the root, so they never collide.
+*/
+
+static int tmpfs_dirent_readdir(struct fs_dirent *d, char *buffer, int buffer_length, uint32_t *cookie)
+{
+	struct tmpfs_node *n = d->tmp.node;
+	struct tmpfs_item *i;
+	int total = 0;
+	int used;
+
+	if(!n->isdir)
+		return KERROR_NOT_A_DIRECTORY;
+
+	if(*cookie == 0) {
+		used = fs_readdir_pack(buffer, buffer_length, ".", 1, 1, n->inumber, 0);
+		if(!used)
+			return KERROR_INVALID_REQUEST;
+		total += used;
+		*cookie = 1;
+	}
+
+	if(*cookie == 1) {
+		struct tmpfs_node *p = n->parent ? n->parent : n;
+		used = fs_readdir_pack(buffer + total, buffer_length - total, "..", 2, 1, p->inumber, 0);
+		if(!used)
+			return total ? total : KERROR_INVALID_REQUEST;
+		total += used;
+		*cookie = 2;
+	}
+
+	for(i = n->items; i; i = i->next) {
+		if(i->node->inumber < *cookie)
+			continue;
+		used = fs_readdir_pack(buffer + total, buffer_length - total, i->name, strlen(i->name), i->node->isdir, i->node->inumber, i->node->size);
+		if(!used)
+			return total ? total : KERROR_INVALID_REQUEST;
+		total += used;
+		*cookie = i->node->inumber + 1;
+	}
+
+	return total;
+}
+
+static int tmpfs_dirent_remove(struct fs_dirent *d, const char *name)
+{
+	struct tmpfs_node *n = d->tmp.node;
+	struct tmpfs_item **p;
+
+	if(!n->isdir)
+		return KERROR_NOT_A_DIRECTORY;
+
+	for(p = &n->items; *p; p = &(*p)->next) {
+		struct tmpfs_item *i = *p;
+		if(!strcmp(i->name, name)) {
+			if(i->node->isdir && i->node->items)
+				return KERROR_NOT_EMPTY;
+			*p = i->next;
+			i->node->parent = 0;
+			tmpfs_node_release(i->node);
+			kfree(i->name);
+			kfree(i);
+			return 0;
+		}
+	}
+
+	return KERROR_NOT_FOUND;
+}
+
+static int tmpfs_dirent_resize(struct fs_dirent *d, uint32_t size)
+{
+	struct tmpfs_node *n = d->tmp.node;
+
+	if(n->isdir)
+		return KERROR_NOT_A_FILE;
+	if(size > TMPFS_MAX_FILE_PAGES * PAGE_SIZE)
+		return KERROR_OUT_OF_SPACE;
+
+	if(size < n->size) {
+		uint32_t keep = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+		tmpfs_node_truncate(n, keep);
+		// Clear the tail of the last page, so that growing again reads zeros.
+		if(size % PAGE_SIZE && n->pages && n->pages[keep - 1]) {
+			memset(n->pages[keep - 1] + size % PAGE_SIZE, 0, PAGE_SIZE - size % PAGE_SIZE);
+		}
+	}
+
+	d->size = n->size = size;
+	return 0;
+}
+
+static uint32_t tmpfs_dirent_size(struct fs_dirent *d)
+{
+	return d->tmp.node->size;
+}
+
+static int tmpfs_dirent_close(struct fs_dirent *d)
+{
+	tmpfs_node_release(d->tmp.node);
+	return 0;
+}
+
+extern struct fs tmp_fs;
+
+static struct fs_volume *tmpfs_volume_open(struct device *device)
+{
+	struct fs_volume *v = kmalloc(sizeof(*v));
+	if(!v)
+		return 0;
+
+	memset(v, 0, sizeof(*v));
+	v->fs = &tmp_fs;
+	v->block_size = PAGE_SIZE;
+	v->refcount = 1;
+
+	v->tmp.root = tmpfs_node_create(1, 0);
+	if(!v->tmp.root) {
+		kfree(v);
+		return 0;
+	}
+
+	return v;
+}
+
+static int tmpfs_volume_close(struct fs_volume *v)
+{
+	tmpfs_node_release(v->tmp.root);
+	return 0;
+}
+
+static struct fs_dirent *tmpfs_volume_root(struct fs_volume *v)
+{
+	return tmpfs_dirent_create(v, v->tmp.root);
+}
+
+const static struct fs_ops tmpfs_ops = {
+	.volume_open = tmpfs_volume_open,
+	.volume_close = tmpfs_volume_close,
+	.volume_root = tmpfs_volume_root,
+
+	.lookup = tmpfs_dirent_lookup,
+	.mkdir = tmpfs_dirent_mkdir,
+	.mkfile = tmpfs_dirent_mkfile,
+	.read_block = tmpfs_dirent_read_block,
+	.write_block = tmpfs_dirent_write_block,
+	.list = tmpfs_dirent_list,
+	.readdir = tmpfs_dirent_readdir,
+	.remove = tmpfs_dirent_remove,
+	.resize = tmpfs_dirent_resize,
+	.size = tmpfs_dirent_size,
+	.close = tmpfs_dirent_close,
+};
+
+struct fs tmp_fs = {
+	"tmpfs",
+	&tmpfs_ops,
+	0
+};
+
+void tmpfs_get_stats(struct tmpfs_stats *s)
+{
+	s->pages_used = pages_used;
+	s->pages_max = pages_max;
+	s->nodes = nodes;
+}
+
+int tmpfs_init()
+{
+	uint32_t nfree, ntotal;
+
+	// Leave at least half of physical memory for everything else.
+	page_stats(&nfree, &ntotal, 0);
+	pages_max = ntotal / 2;
+
+	fs_register(&tmp_fs);
+	return 0;
+}
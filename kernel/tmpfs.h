@@ -0,0 +1,41 @@
+/*
+Copyright (C) 2016-2019 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file LICENSE for details.
+*/
+
+#ifndef TMPFS_H
+#define TMPFS_H
+
+#include "kernel/types.h"
+
+/*
+tmpfs keeps an entire filesystem in kernel memory, without a device
+or the bcache.  Each file has a single page of pointers to its data
+pages, so the largest file is TMPFS_MAX_FILE_PAGES pages.
+The pages used by all tmpfs volumes together are limited to a
+fraction of physical memory, chosen when tmpfs is initialized.
+*/
+
+#define TMPFS_MAX_FILE_PAGES (PAGE_SIZE/sizeof(char *))
+
+struct tmpfs_node;
+
+struct tmpfs_volume {
+	struct tmpfs_node *root;
+};
+
+struct tmpfs_dirent {
+	struct tmpfs_node *node;
+};
+
+struct tmpfs_stats {
+	uint32_t pages_used;
+	uint32_t pages_max;
+	uint32_t nodes;
+};
+
+int  tmpfs_init();
+void tmpfs_get_stats( struct tmpfs_stats *s );
+
+#endif
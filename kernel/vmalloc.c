@@ -0,0 +1,123 @@
+/*
+Copyright (C) 2016-2019 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file LICENSE for details.
+*/
+
+#include "vmalloc.h"
+#include "pagetable.h"
+#include "console.h"
+#include "kernel/types.h"
+#include "memorylayout.h"
+
+#define VMALLOC_PAGES ((KERNEL_VMALLOC_END - KERNEL_VMALLOC_START) / PAGE_SIZE)
+#define CELL_BITS 32
+
+/* One bit for each page of the range, set while it is in use or a guard. */
+static uint32_t vmap[VMALLOC_PAGES / CELL_BITS];
+
+static int vmap_test(uint32_t n)
+{
+	return vmap[n / CELL_BITS] & (1 << (n % CELL_BITS));
+}
+
+static void vmap_set(uint32_t n, uint32_t count, int value)
+{
+	for(; count > 0; n++, count--) {
+		if(value) {
+			vmap[n / CELL_BITS] |= (1 << (n % CELL_BITS));
+		} else {
+			vmap[n / CELL_BITS] &= ~(1 << (n % CELL_BITS));
+		}
+	}
+}
+
+/* Find the first run of count free pages, returning its page number, or -1. */
+
+static int vmap_find(uint32_t count)
+{
+	uint32_t n = 0, run = 0;
+
+	while(n < VMALLOC_PAGES) {
+		if(n % CELL_BITS == 0 && vmap[n / CELL_BITS] == 0xffffffff) {
+			n += CELL_BITS;
+			run = 0;
+			continue;
+		}
+		if(vmap_test(n)) {
+			run = 0;
+		} else if(++run == count) {
+			return n + 1 - count;
+		}
+		n++;
+	}
+
+	return -1;
+}
+
+void vmalloc_init()
+{
+	printf("vmalloc: %d MB of kernel virtual space at %x\n", (KERNEL_VMALLOC_END - KERNEL_VMALLOC_START) / MEGA, KERNEL_VMALLOC_START);
+}
+
+void *vmalloc(unsigned length)
+{
+	struct pagetable *p = pagetable_kernel();
+	uint32_t npages = (length + PAGE_SIZE - 1) / PAGE_SIZE;
+	uint32_t i;
+
+	if(!p || npages == 0 || npages >= VMALLOC_PAGES)
+		return 0;
+
+	// Reserve one more page than needed, to be left unmapped as the guard.
+	int first = vmap_find(npages + 1);
+	if(first < 0) {
+		printf("vmalloc: out of address space!\n");
+		return 0;
+	}
+
+	unsigned vaddr = KERNEL_VMALLOC_START + first * PAGE_SIZE;
+
+	for(i = 0; i < npages; i++) {
+		if(!pagetable_map(p, vaddr + i * PAGE_SIZE, 0, PAGE_FLAG_KERNEL | PAGE_FLAG_READWRITE | PAGE_FLAG_ALLOC)) {
+			pagetable_free(p, vaddr, i * PAGE_SIZE);
+			pagetable_refresh_global();
+			printf("vmalloc: out of memory!\n");
+			return 0;
+		}
+	}
+
+	vmap_set(first, npages + 1, 1);
+
+	return (void *) vaddr;
+}
+
+void vfree(void *addr)
+{
+	struct pagetable *p = pagetable_kernel();
+	unsigned vaddr = (unsigned) addr;
+	unsigned paddr;
+
+	if(vaddr < KERNEL_VMALLOC_START || vaddr >= KERNEL_VMALLOC_END || vaddr % PAGE_SIZE) {
+		printf("invalid vfree(%x)\n", addr);
+		return;
+	}
+
+	uint32_t first = (vaddr - KERNEL_VMALLOC_START) / PAGE_SIZE;
+	uint32_t npages = 0;
+
+	// The buffer ends at its guard page, the first one not mapped.
+	while(pagetable_getmap(p, vaddr + npages * PAGE_SIZE, &paddr, 0))
+		npages++;
+
+	// A buffer always starts just after a guard page, or at the start of the range.
+	if(npages == 0 || (first > 0 && pagetable_getmap(p, vaddr - PAGE_SIZE, &paddr, 0))) {
+		printf("invalid vfree(%x)\n", addr);
+		return;
+	}
+
+	pagetable_free(p, vaddr, npages * PAGE_SIZE);
+	pagetable_refresh_global();
+
+	vmap_set(first, npages + 1, 0);
+}
@@ -0,0 +1,22 @@
+/*
+Copyright (C) 2016-2019 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file LICENSE for details.
+*/
+
+#ifndef VMALLOC_H
+#define VMALLOC_H
+
+/*
+vmalloc builds a buffer that is contiguous in the kernel virtual
+address space out of individual pages from page_alloc, so that
+large buffers don't depend on the size of the kmalloc area, or on
+finding physically contiguous memory.  Each buffer is followed by
+an unmapped guard page, which catches overruns and marks its end.
+*/
+
+void  vmalloc_init();
+void *vmalloc(unsigned length);
+void  vfree(void *addr);
+
+#endif
@@ -7,6 +7,7 @@ See the file LICENSE for details.
 #include "kernel/syscall.h"
 #include "kernel/stats.h"
 #include "kernel/gfxstream.h"
+#include "kernel/io_ring.h"
 
 void syscall_debug(const char *str)
 {
@@ -78,9 +79,17 @@ int syscall_process_stats(struct process_stats *s, unsigned int pid)
 	return syscall(SYSCALL_PROCESS_STATS, (uint32_t) s, pid, 0, 0, 0);
 }
 
+/*
+An error is a small negative number, never a heap address.
+Report it as sbrk does, with (void *) -1, which malloc checks for.
+*/
+
 extern void *syscall_process_heap(int a)
 {
-	return (void *) syscall(SYSCALL_PROCESS_HEAP, a, 0, 0, 0, 0);
+	int result = syscall(SYSCALL_PROCESS_HEAP, a, 0, 0, 0, 0);
+	if(result < 0 && result > -PAGE_SIZE)
+		return (void *) -1;
+	return (void *) result;
 }
 
 int syscall_open_file(const char *path, int mode, kernel_flags_t flags)
@@ -138,16 +147,56 @@ int syscall_object_list( int fd, char *buffer, int n)
 	return syscall(SYSCALL_OBJECT_LIST, fd, (uint32_t) buffer, (uint32_t) n, 0, 0);
 }
 
+int syscall_object_readdir( int fd, struct dir_entry *buffer, int n, uint32_t *cookie )
+{
+	return syscall(SYSCALL_OBJECT_READDIR, fd, (uint32_t) buffer, (uint32_t) n, (uint32_t) cookie, 0);
+}
+
 int syscall_object_write(int fd, void *data, int length)
 {
 	return syscall(SYSCALL_OBJECT_WRITE, fd, (uint32_t) data, length, 0, 0);
 }
 
+int syscall_object_readv(int fd, struct iovec *iov, int count)
+{
+	return syscall(SYSCALL_OBJECT_READV, fd, (uint32_t) iov, count, 0, 0);
+}
+
+int syscall_object_writev(int fd, struct iovec *iov, int count)
+{
+	return syscall(SYSCALL_OBJECT_WRITEV, fd, (uint32_t) iov, count, 0, 0);
+}
+
+int syscall_io_ring_enter(struct io_ring *ring, int to_submit, int min_complete)
+{
+	return syscall(SYSCALL_IO_RING_ENTER, (uint32_t) ring, to_submit, min_complete, 0, 0);
+}
+
+int syscall_object_mmap(int fd, int offset, int length, int flags, void **addr)
+{
+	return syscall(SYSCALL_OBJECT_MMAP, fd, offset, length, flags, (uint32_t) addr);
+}
+
+int syscall_process_munmap(void *addr)
+{
+	return syscall(SYSCALL_PROCESS_MUNMAP, (uint32_t) addr, 0, 0, 0, 0);
+}
+
 int syscall_object_seek(int fd, int offset, int whence)
 {
 	return syscall(SYSCALL_OBJECT_SEEK, fd, offset, whence, 0, 0);
 }
 
+int syscall_object_pread(int fd, void *data, int length, int offset)
+{
+	return syscall(SYSCALL_OBJECT_PREAD, fd, (uint32_t) data, length, offset, 0);
+}
+
+int syscall_object_pwrite(int fd, void *data, int length, int offset)
+{
+	return syscall(SYSCALL_OBJECT_PWRITE, fd, (uint32_t) data, length, offset, 0);
+}
+
 int syscall_object_remove(int fd, const char *name )
 {
 	return syscall(SYSCALL_OBJECT_REMOVE, fd, (uint32_t) name, 0, 0, 0 );
@@ -158,6 +207,31 @@ int syscall_object_close(int fd)
 	return syscall(SYSCALL_OBJECT_CLOSE, fd, 0, 0, 0, 0);
 }
 
+int syscall_object_fsync(int fd)
+{
+	return syscall(SYSCALL_OBJECT_FSYNC, fd, 0, 0, 0, 0);
+}
+
+int syscall_object_fdatasync(int fd)
+{
+	return syscall(SYSCALL_OBJECT_FDATASYNC, fd, 0, 0, 0, 0);
+}
+
+int syscall_object_extents(int fd, struct fs_extent_stats *s)
+{
+	return syscall(SYSCALL_OBJECT_EXTENTS, fd, (uint32_t) s, 0, 0, 0);
+}
+
+int syscall_object_defrag(int fd)
+{
+	return syscall(SYSCALL_OBJECT_DEFRAG, fd, 0, 0, 0, 0);
+}
+
+int syscall_object_transfer(int src, int dst, int length)
+{
+	return syscall(SYSCALL_OBJECT_TRANSFER, src, dst, length, 0, 0);
+}
+
 int syscall_object_set_tag(int fd, char *tag)
 {
 	return syscall(SYSCALL_OBJECT_SET_TAG, fd, (uint32_t)tag, 0, 0, 0);
@@ -0,0 +1,350 @@
+/*
+Copyright (C) 2016-2019 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file LICENSE for details.
+*/
+
+/*
+mkdiskfs builds a populated diskfs image on the host, so that a disk
+does not have to be formatted and filled from inside the kernel.
+Each directory named on the command line becomes a top level directory
+of the image.  Data blocks are handed out in order as the tree is
+walked, so each directory and each file occupies a contiguous run of
+blocks, with the indirect block of a large file just ahead of its data.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/*
+The on-disk structures are made only of fixed size integers,
+so use the host definitions of those in place of kernel/types.h.
+*/
+
+#define KERNELTYPES_H
+#include "diskfs.h"
+
+#define DISKFS_MAX_FILE_BLOCKS (DISKFS_DIRECT_POINTERS+DISKFS_POINTERS_PER_BLOCK)
+
+static struct diskfs_superblock sb;
+static struct diskfs_block *image = 0;
+static uint32_t image_blocks = 0;
+
+static uint32_t next_inumber = 0;
+static uint32_t next_data_block = 0;
+
+static uint32_t total_files = 0;
+static uint32_t total_inline = 0;
+static uint32_t total_dirs = 0;
+
+static void *xrealloc(void *p, size_t size)
+{
+	p = realloc(p, size);
+	if(!p) {
+		fprintf(stderr, "mkdiskfs: out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+static struct diskfs_inode *inode_get(uint32_t inumber)
+{
+	struct diskfs_block *b = &image[sb.inode_start + inumber / DISKFS_INODES_PER_BLOCK];
+	return &b->inodes[inumber % DISKFS_INODES_PER_BLOCK];
+}
+
+static uint32_t inode_alloc()
+{
+	if(next_inumber >= sb.inode_blocks * DISKFS_INODES_PER_BLOCK) {
+		fprintf(stderr, "mkdiskfs: out of inodes\n");
+		exit(1);
+	}
+	uint32_t inumber = next_inumber++;
+	inode_get(inumber)->flags = DISKFS_INODE_INUSE;
+	return inumber;
+}
+
+/* Allocate n consecutive data blocks, returning the first. */
+
+static uint32_t data_alloc(uint32_t n)
+{
+	if(next_data_block + n > sb.data_blocks) {
+		fprintf(stderr, "mkdiskfs: out of space\n");
+		exit(1);
+	}
+
+	uint32_t first = next_data_block;
+	uint32_t i;
+
+	for(i = first; i < first + n; i++) {
+		struct diskfs_block *b = &image[sb.bitmap_start + i / (DISKFS_BLOCK_SIZE * 8)];
+		uint32_t bit = i % (DISKFS_BLOCK_SIZE * 8);
+		b->data[bit / 8] |= 1 << (bit % 8);
+	}
+
+	next_data_block += n;
+	return first;
+}
+
+static struct diskfs_block *data_get(uint32_t blockno)
+{
+	return &image[sb.data_start + blockno];
+}
+
+/*
+Give the inode nblocks contiguous data blocks, and return
+a pointer to the first of them in the image.  The blocks
+are always consecutive, so the caller can fill them in one go.
+*/
+
+static struct diskfs_block *inode_alloc_blocks(struct diskfs_inode *inode, uint32_t nblocks)
+{
+	uint32_t i;
+
+	if(nblocks > DISKFS_MAX_FILE_BLOCKS) {
+		fprintf(stderr, "mkdiskfs: file too large\n");
+		exit(1);
+	}
+
+	if(nblocks > DISKFS_DIRECT_POINTERS) {
+		inode->indirect = data_alloc(1);
+	}
+
+	uint32_t first = data_alloc(nblocks);
+
+	for(i = 0; i < nblocks; i++) {
+		if(i < DISKFS_DIRECT_POINTERS) {
+			inode->direct[i] = first + i;
+		} else {
+			data_get(inode->indirect)->pointers[i - DISKFS_DIRECT_POINTERS] = first + i;
+		}
+	}
+
+	return data_get(first);
+}
+
+static void add_file(const char *path, uint32_t inumber)
+{
+	FILE *file = fopen(path, "rb");
+	if(!file) {
+		fprintf(stderr, "mkdiskfs: couldn't open %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+
+	struct stat info;
+	fstat(fileno(file), &info);
+
+	struct diskfs_inode *inode = inode_get(inumber);
+	void *data;
+
+	// A small file is stored in the inode, just as the kernel would.
+	if(info.st_size <= DISKFS_INLINE_SIZE) {
+		inode->flags |= DISKFS_INODE_INLINE;
+		data = inode->data;
+		total_inline++;
+	} else {
+		uint32_t nblocks = (info.st_size + DISKFS_BLOCK_SIZE - 1) / DISKFS_BLOCK_SIZE;
+		data = inode_alloc_blocks(inode, nblocks);
+	}
+
+	if(fread(data, 1, info.st_size, file) != info.st_size) {
+		fprintf(stderr, "mkdiskfs: couldn't read %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+
+	fclose(file);
+
+	inode->size = info.st_size;
+	total_files++;
+}
+
+static int name_compare(const void *a, const void *b)
+{
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static void item_set(struct diskfs_item *r, const char *name, uint32_t inumber, int type)
+{
+	size_t length = strlen(name);
+	if(length > sizeof(r->name)) {
+		fprintf(stderr, "mkdiskfs: name too long: %s\n", name);
+		exit(1);
+	}
+
+	r->inumber = inumber;
+	r->type = type;
+	r->name_length = length;
+	memcpy(r->name, name, length);
+}
+
+/*
+Add a directory, given the names and host paths of its children.
+The root directory starts with a "." item, just as when it is
+created by diskfs_volume_format, while other directories do not.
+*/
+
+static void add_dir(uint32_t self, int isroot, char **names, char **paths, int n)
+{
+	uint32_t *children = xrealloc(0, (n + 1) * sizeof(*children));
+	int *types = xrealloc(0, (n + 1) * sizeof(*types));
+	int nitems = n + (isroot ? 1 : 0);
+	int i;
+
+	for(i = 0; i < n; i++) {
+		struct stat info;
+		if(stat(paths[i], &info) < 0) {
+			fprintf(stderr, "mkdiskfs: couldn't stat %s: %s\n", paths[i], strerror(errno));
+			exit(1);
+		}
+		if(S_ISDIR(info.st_mode)) {
+			types[i] = DISKFS_ITEM_DIR;
+		} else if(S_ISREG(info.st_mode)) {
+			types[i] = DISKFS_ITEM_FILE;
+		} else {
+			fprintf(stderr, "mkdiskfs: skipping %s: not a file or directory\n", paths[i]);
+			types[i] = DISKFS_ITEM_BLANK;
+			continue;
+		}
+		children[i] = inode_alloc();
+	}
+
+	struct diskfs_inode *inode = inode_get(self);
+	uint32_t nblocks = (nitems * sizeof(struct diskfs_item) + DISKFS_BLOCK_SIZE - 1) / DISKFS_BLOCK_SIZE;
+	struct diskfs_item *items = (struct diskfs_item *) inode_alloc_blocks(inode, nblocks);
+	int j = 0;
+
+	if(isroot)
+		item_set(&items[j++], ".", self, DISKFS_ITEM_DIR);
+
+	for(i = 0; i < n; i++) {
+		if(types[i] != DISKFS_ITEM_BLANK)
+			item_set(&items[j++], names[i], children[i], types[i]);
+	}
+
+	inode->size = j * sizeof(struct diskfs_item);
+	total_dirs++;
+
+	for(i = 0; i < n; i++) {
+		if(types[i] == DISKFS_ITEM_DIR) {
+			DIR *dir = opendir(paths[i]);
+			if(!dir) {
+				fprintf(stderr, "mkdiskfs: couldn't open %s: %s\n", paths[i], strerror(errno));
+				exit(1);
+			}
+
+			char **cnames = 0;
+			char **cpaths = 0;
+			int cn = 0;
+			struct dirent *e;
+
+			while((e = readdir(dir))) {
+				if(!strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+					continue;
+				cnames = xrealloc(cnames, (cn + 1) * sizeof(char *));
+				cnames[cn++] = strdup(e->d_name);
+			}
+			closedir(dir);
+
+			qsort(cnames, cn, sizeof(char *), name_compare);
+
+			cpaths = xrealloc(cpaths, (cn + 1) * sizeof(char *));
+			int k;
+			for(k = 0; k < cn; k++) {
+				cpaths[k] = xrealloc(0, strlen(paths[i]) + strlen(cnames[k]) + 2);
+				sprintf(cpaths[k], "%s/%s", paths[i], cnames[k]);
+			}
+
+			add_dir(children[i], 0, cnames, cpaths, cn);
+
+			for(k = 0; k < cn; k++) {
+				free(cnames[k]);
+				free(cpaths[k]);
+			}
+			free(cnames);
+			free(cpaths);
+		} else if(types[i] == DISKFS_ITEM_FILE) {
+			add_file(paths[i], children[i]);
+		}
+	}
+
+	free(children);
+	free(types);
+}
+
+/* Compute the layout in the same way as diskfs_volume_format. */
+
+static void layout(uint32_t nblocks)
+{
+	sb.magic = DISKFS_MAGIC;
+	sb.block_size = DISKFS_BLOCK_SIZE;
+	sb.inode_blocks = 1024 / sizeof(struct diskfs_inode);
+	sb.journal_blocks = DISKFS_JOURNAL_BLOCKS;
+
+	uint32_t remaining_blocks = nblocks - 1 - sb.journal_blocks - sb.inode_blocks;
+	sb.bitmap_blocks = 1 + remaining_blocks / (DISKFS_BLOCK_SIZE * 8);
+	sb.data_blocks = remaining_blocks - sb.bitmap_blocks;
+
+	sb.journal_start = 1;
+	sb.inode_start = sb.journal_start + sb.journal_blocks;
+	sb.bitmap_start = sb.inode_start + sb.inode_blocks;
+	sb.data_start = sb.bitmap_start + sb.bitmap_blocks;
+}
+
+int main(int argc, char *argv[])
+{
+	int i, megabytes;
+
+	if(argc < 4 || (megabytes = atoi(argv[2])) <= 0) {
+		fprintf(stderr, "use: %s <image> <megabytes> <dir> [<dir> ...]\n", argv[0]);
+		return 1;
+	}
+
+	image_blocks = megabytes * 1024 * 1024 / DISKFS_BLOCK_SIZE;
+	image = xrealloc(0, image_blocks * DISKFS_BLOCK_SIZE);
+	memset(image, 0, image_blocks * DISKFS_BLOCK_SIZE);
+
+	layout(image_blocks);
+	image[0].superblock = sb;
+
+	// An empty journal: replay begins with the first transaction, at the first position.
+	image[sb.journal_start].journal.magic = DISKFS_JOURNAL_MAGIC;
+	image[sb.journal_start].journal.sequence = 1;
+	image[sb.journal_start].journal.start = 0;
+
+	// Block zero is never allocated, and the root directory is always inode zero.
+	data_alloc(1);
+	uint32_t root = inode_alloc();
+
+	int n = argc - 3;
+	char **names = xrealloc(0, n * sizeof(char *));
+	char **paths = &argv[3];
+
+	for(i = 0; i < n; i++) {
+		char *slash = strrchr(paths[i], '/');
+		names[i] = slash ? slash + 1 : paths[i];
+	}
+
+	add_dir(root, 1, names, paths, n);
+
+	FILE *file = fopen(argv[1], "wb");
+	if(!file) {
+		fprintf(stderr, "mkdiskfs: couldn't create %s: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+
+	if(fwrite(image, DISKFS_BLOCK_SIZE, image_blocks, file) != image_blocks) {
+		fprintf(stderr, "mkdiskfs: write failed: %s\n", strerror(errno));
+		return 1;
+	}
+
+	fclose(file);
+
+	printf("mkdiskfs: %s: %u files (%u inline), %u directories, %u of %u data blocks used\n", argv[1], total_files, total_inline, total_dirs, next_data_block, sb.data_blocks);
+
+	return 0;
+}
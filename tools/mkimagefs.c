@@ -0,0 +1,356 @@
+/*
+Copyright (C) 2016-2019 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file LICENSE for details.
+*/
+
+/*
+mkimagefs builds a compressed, read-only imagefs image on the host.
+Each directory named on the command line becomes a top level
+directory of the image, so that "mkimagefs out.img image/bin"
+produces an image containing /bin.  See kernel/imagefs.h for the layout.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/*
+The on-disk structures are made only of fixed size integers,
+so use the host definitions of those in place of kernel/types.h.
+*/
+
+#define KERNELTYPES_H
+#include "imagefs.h"
+
+static struct imagefs_inode *inodes = 0;
+static uint32_t inode_count = 0;
+
+static struct imagefs_extent *extents = 0;
+static uint32_t extent_count = 0;
+
+static char *dirs = 0;
+static uint32_t dir_length = 0;
+
+static uint8_t *data = 0;
+static uint32_t data_length = 0;
+
+static uint32_t total_files = 0;
+static uint32_t total_bytes = 0;
+
+static void *xrealloc(void *p, size_t size)
+{
+	p = realloc(p, size);
+	if(!p) {
+		fprintf(stderr, "mkimagefs: out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+static uint32_t inode_alloc()
+{
+	inodes = xrealloc(inodes, (inode_count + 1) * sizeof(*inodes));
+	memset(&inodes[inode_count], 0, sizeof(*inodes));
+	return inode_count++;
+}
+
+static void dir_append(const char *name, uint32_t inumber)
+{
+	size_t length = strlen(name);
+	if(length > 255) {
+		fprintf(stderr, "mkimagefs: name too long: %s\n", name);
+		exit(1);
+	}
+
+	struct imagefs_item item;
+	item.inumber = inumber;
+	item.name_length = length;
+
+	dirs = xrealloc(dirs, dir_length + sizeof(item) + length);
+	memcpy(&dirs[dir_length], &item, sizeof(item));
+	memcpy(&dirs[dir_length + sizeof(item)], name, length);
+	dir_length += sizeof(item) + length;
+}
+
+static void data_append(const uint8_t *buffer, uint32_t length, uint32_t flags)
+{
+	extents = xrealloc(extents, (extent_count + 1) * sizeof(*extents));
+	extents[extent_count].offset = data_length;
+	extents[extent_count].length = length | flags;
+	extent_count++;
+
+	data = xrealloc(data, data_length + length);
+	memcpy(&data[data_length], buffer, length);
+	data_length += length;
+}
+
+/*
+A simple greedy LZ4 block compressor: hash each four byte sequence,
+and emit a match whenever the hashed position really matches.
+As required by the format, the last five bytes are always literals,
+and no match starts within the last twelve bytes.
+Returns the compressed length, which may exceed the input.
+*/
+
+#define HASH_BITS 12
+
+static uint32_t read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint8_t *lz4_put_length(uint8_t *op, uint32_t length)
+{
+	while(length >= 255) {
+		*op++ = 255;
+		length -= 255;
+	}
+	*op++ = length;
+	return op;
+}
+
+static uint8_t *lz4_put_sequence(uint8_t *op, const uint8_t *literals, uint32_t nliterals, uint32_t offset, uint32_t match)
+{
+	uint8_t *token = op++;
+	*token = (nliterals >= 15 ? 15 : nliterals) << 4;
+	if(nliterals >= 15)
+		op = lz4_put_length(op, nliterals - 15);
+	memcpy(op, literals, nliterals);
+	op += nliterals;
+
+	if(match) {
+		*op++ = offset & 0xff;
+		*op++ = offset >> 8;
+		match -= 4;
+		*token |= match >= 15 ? 15 : match;
+		if(match >= 15)
+			op = lz4_put_length(op, match - 15);
+	}
+	return op;
+}
+
+static uint32_t lz4_compress(const uint8_t *src, uint32_t n, uint8_t *dst)
+{
+	int32_t table[1 << HASH_BITS];
+	uint32_t anchor = 0;
+	uint32_t i = 0;
+	uint8_t *op = dst;
+
+	memset(table, 0xff, sizeof(table));
+
+	while(n > 12 && i < n - 12) {
+		uint32_t seq = read32(&src[i]);
+		uint32_t h = (seq * 2654435761u) >> (32 - HASH_BITS);
+		int32_t ref = table[h];
+		table[h] = i;
+
+		if(ref >= 0 && i - ref < 65536 && read32(&src[ref]) == seq) {
+			uint32_t length = 4;
+			while(i + length < n - 5 && src[ref + length] == src[i + length])
+				length++;
+			op = lz4_put_sequence(op, &src[anchor], i - anchor, i - ref, length);
+			i += length;
+			anchor = i;
+		} else {
+			i++;
+		}
+	}
+
+	op = lz4_put_sequence(op, &src[anchor], n - anchor, 0, 0);
+	return op - dst;
+}
+
+static void add_file(const char *path, uint32_t inumber)
+{
+	FILE *file = fopen(path, "rb");
+	if(!file) {
+		fprintf(stderr, "mkimagefs: couldn't open %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+
+	uint8_t block[IMAGEFS_BLOCK_SIZE];
+	uint8_t packed[IMAGEFS_BLOCK_SIZE * 2];
+	uint32_t size = 0;
+	size_t n;
+
+	inodes[inumber].type = IMAGEFS_ITEM_FILE;
+	inodes[inumber].start = extent_count;
+
+	while((n = fread(block, 1, sizeof(block), file)) > 0) {
+		uint32_t plength = lz4_compress(block, n, packed);
+		if(plength < n) {
+			data_append(packed, plength, 0);
+		} else {
+			data_append(block, n, IMAGEFS_EXTENT_RAW);
+		}
+		size += n;
+	}
+
+	fclose(file);
+
+	inodes[inumber].size = size;
+	total_files++;
+	total_bytes += size;
+}
+
+static int name_compare(const void *a, const void *b)
+{
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/*
+Add a directory, given the names and host paths of its children.
+All items of a directory must be contiguous in the directory table,
+so the items are written first, and then the children are visited.
+*/
+
+static void add_dir(uint32_t self, uint32_t parent, char **names, char **paths, int n)
+{
+	uint32_t *children = xrealloc(0, (n + 1) * sizeof(*children));
+	int i;
+
+	inodes[self].type = IMAGEFS_ITEM_DIR;
+	inodes[self].start = dir_length;
+
+	dir_append(".", self);
+	dir_append("..", parent);
+
+	for(i = 0; i < n; i++) {
+		children[i] = inode_alloc();
+		dir_append(names[i], children[i]);
+	}
+
+	inodes[self].size = dir_length - inodes[self].start;
+
+	for(i = 0; i < n; i++) {
+		struct stat info;
+		if(stat(paths[i], &info) < 0) {
+			fprintf(stderr, "mkimagefs: couldn't stat %s: %s\n", paths[i], strerror(errno));
+			exit(1);
+		}
+
+		if(S_ISDIR(info.st_mode)) {
+			DIR *dir = opendir(paths[i]);
+			if(!dir) {
+				fprintf(stderr, "mkimagefs: couldn't open %s: %s\n", paths[i], strerror(errno));
+				exit(1);
+			}
+
+			char **cnames = 0;
+			char **cpaths = 0;
+			int cn = 0;
+			struct dirent *e;
+
+			while((e = readdir(dir))) {
+				if(!strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+					continue;
+				cnames = xrealloc(cnames, (cn + 1) * sizeof(char *));
+				cnames[cn++] = strdup(e->d_name);
+			}
+			closedir(dir);
+
+			qsort(cnames, cn, sizeof(char *), name_compare);
+
+			cpaths = xrealloc(cpaths, (cn + 1) * sizeof(char *));
+			int j;
+			for(j = 0; j < cn; j++) {
+				cpaths[j] = xrealloc(0, strlen(paths[i]) + strlen(cnames[j]) + 2);
+				sprintf(cpaths[j], "%s/%s", paths[i], cnames[j]);
+			}
+
+			add_dir(children[i], self, cnames, cpaths, cn);
+
+			for(j = 0; j < cn; j++) {
+				free(cnames[j]);
+				free(cpaths[j]);
+			}
+			free(cnames);
+			free(cpaths);
+		} else if(S_ISREG(info.st_mode)) {
+			add_file(paths[i], children[i]);
+		} else {
+			fprintf(stderr, "mkimagefs: skipping %s: not a file or directory\n", paths[i]);
+			inodes[children[i]].type = IMAGEFS_ITEM_FILE;
+			inodes[children[i]].start = extent_count;
+		}
+	}
+
+	free(children);
+}
+
+static uint32_t align4(uint32_t x)
+{
+	return (x + 3) & ~3;
+}
+
+static void write_at(FILE *file, const void *buffer, uint32_t length, uint32_t offset)
+{
+	if(fseek(file, offset, SEEK_SET) < 0 || fwrite(buffer, 1, length, file) != length) {
+		fprintf(stderr, "mkimagefs: write failed: %s\n", strerror(errno));
+		exit(1);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+
+	if(argc < 3) {
+		fprintf(stderr, "use: %s <image> <dir> [<dir> ...]\n", argv[0]);
+		return 1;
+	}
+
+	int n = argc - 2;
+	char **names = xrealloc(0, n * sizeof(char *));
+	char **paths = &argv[2];
+
+	for(i = 0; i < n; i++) {
+		char *slash = strrchr(paths[i], '/');
+		names[i] = slash ? slash + 1 : paths[i];
+	}
+
+	uint32_t root = inode_alloc();
+	add_dir(root, root, names, paths, n);
+
+	struct imagefs_superblock sb;
+	memset(&sb, 0, sizeof(sb));
+	sb.magic = IMAGEFS_MAGIC;
+	sb.block_size = IMAGEFS_BLOCK_SIZE;
+	sb.extent_start = align4(sizeof(sb));
+	sb.extent_count = extent_count;
+	sb.inode_start = align4(sb.extent_start + extent_count * sizeof(struct imagefs_extent));
+	sb.inode_count = inode_count;
+	sb.dir_start = align4(sb.inode_start + inode_count * sizeof(struct imagefs_inode));
+	sb.dir_length = dir_length;
+
+	uint32_t data_start = align4(sb.dir_start + dir_length);
+
+	for(i = 0; i < extent_count; i++) {
+		extents[i].offset += data_start;
+	}
+
+	FILE *file = fopen(argv[1], "wb");
+	if(!file) {
+		fprintf(stderr, "mkimagefs: couldn't create %s: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+
+	write_at(file, &sb, sizeof(sb), 0);
+	write_at(file, extents, extent_count * sizeof(struct imagefs_extent), sb.extent_start);
+	write_at(file, inodes, inode_count * sizeof(struct imagefs_inode), sb.inode_start);
+	write_at(file, dirs, dir_length, sb.dir_start);
+	write_at(file, data, data_length, data_start);
+
+	fclose(file);
+
+	printf("mkimagefs: %s: %u files, %u bytes compressed to %u bytes\n", argv[1], total_files, total_bytes, data_length);
+
+	return 0;
+}
@@ -0,0 +1,136 @@
+/*
+Copyright (C) 2016-2019 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file LICENSE for details.
+*/
+
+/*
+defrag reports how each file under the given paths is laid out
+on disk, as a count of blocks and of runs of consecutive blocks,
+and moves any file held in more than one run into a single run.
+With -n, it only reports.  The free space of the volume is shown
+at the end, since a file can only be moved into a free run.
+*/
+
+#include "library/syscalls.h"
+#include "library/string.h"
+#include "library/errno.h"
+
+static int report_only = 0;
+
+static int total_files = 0;
+static int total_fragmented = 0;
+static int total_moved = 0;
+
+static struct fs_extent_stats volume;
+
+static void defrag_object(int fd, const char *path)
+{
+	struct fs_extent_stats s;
+
+	int result = syscall_object_extents(fd, &s);
+	if(result < 0) {
+		printf("%s: %s\n", path, strerror(result));
+		return;
+	}
+
+	volume = s;
+	total_files++;
+
+	if(s.extents <= 1 || report_only) {
+		printf("%s: %u blocks in %u extents\n", path, s.blocks, s.extents);
+		if(s.extents > 1)
+			total_fragmented++;
+		return;
+	}
+
+	total_fragmented++;
+
+	result = syscall_object_defrag(fd);
+	if(result < 0) {
+		printf("%s: %u blocks in %u extents, couldn't defragment: %s\n", path, s.blocks, s.extents, strerror(result));
+		return;
+	}
+
+	uint32_t before = s.extents;
+	syscall_object_extents(fd, &s);
+	volume = s;
+	total_moved++;
+
+	printf("%s: %u blocks in %u extents, now %u\n", path, s.blocks, before, s.extents);
+}
+
+static void defrag_path(int fd, const char *path)
+{
+	char buffer[1024];
+	char child[256];
+	uint32_t cookie = 0;
+	int length;
+
+	defrag_object(fd, path);
+
+	if(syscall_object_type(fd) != KOBJECT_DIR)
+		return;
+
+	while((length = syscall_object_readdir(fd, (struct dir_entry *) buffer, sizeof(buffer), &cookie)) > 0) {
+		int offset = 0;
+		while(offset < length) {
+			struct dir_entry *e = (struct dir_entry *) &buffer[offset];
+			offset += e->length;
+
+			if(!strcmp(e->name, ".") || !strcmp(e->name, ".."))
+				continue;
+
+			if(strlen(path) + strlen(e->name) + 2 > sizeof(child)) {
+				printf("%s/%s: path too long\n", path, e->name);
+				continue;
+			}
+
+			strcpy(child, path);
+			if(strcmp(path, "/"))
+				strcat(child, "/");
+			strcat(child, e->name);
+
+			int cfd = syscall_open_file_relative(fd, e->name, 0, 0);
+			if(cfd < 0) {
+				printf("couldn't open %s: %s\n", child, strerror(cfd));
+				continue;
+			}
+
+			defrag_path(cfd, child);
+			syscall_object_close(cfd);
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int i = 1;
+
+	if(argc > 1 && !strcmp(argv[1], "-n")) {
+		report_only = 1;
+		i++;
+	}
+
+	if(i >= argc) {
+		printf("use: %s [-n] <path> ...\n", argv[0]);
+		return 1;
+	}
+
+	for(; i < argc; i++) {
+		int fd = syscall_open_file(argv[i], 0, 0);
+		if(fd < 0) {
+			printf("couldn't open %s: %s\n", argv[i], strerror(fd));
+			continue;
+		}
+		defrag_path(fd, argv[i]);
+		syscall_object_close(fd);
+	}
+
+	printf("%d files, %d fragmented, %d defragmented\n", total_files, total_fragmented, total_moved);
+
+	if(total_files > 0)
+		printf("free space: %u blocks in %u extents, largest %u blocks\n", volume.free_blocks, volume.free_extents, volume.largest_free_extent);
+
+	return 0;
+}
@@ -0,0 +1,281 @@
+/*
+Copyright (C) 2016-2019 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file LICENSE for details.
+*/
+
+/*
+fstest exercises the file calls that the other programs leave
+untouched: pread, readv, fsync, transfer, io_ring_enter, and mmap,
+including write-back of a shared mapping and mappings inherited across
+fork.  It works on two scratch files, fstest.tmp and fstest2.tmp, in
+the given directory or the current one, and reports pass or fail
+for each check.  The files are left behind for inspection.
+*/
+
+#include "library/syscalls.h"
+#include "library/string.h"
+#include "library/errno.h"
+
+#define TEST_PAGES 3
+#define TEST_SIZE (TEST_PAGES * PAGE_SIZE)
+
+static char pattern[TEST_SIZE];
+static char buffer[TEST_SIZE];
+static struct io_ring ring;
+
+static int passed = 0;
+static int failed = 0;
+
+static void check(const char *name, int ok)
+{
+	printf("%s: %s\n", name, ok ? "pass" : "FAIL");
+	if(ok)
+		passed++;
+	else
+		failed++;
+}
+
+static int same(const char *a, const char *b, int length)
+{
+	int i;
+	for(i = 0; i < length; i++) {
+		if(a[i] != b[i])
+			return 0;
+	}
+	return 1;
+}
+
+/* Put the file back to the plain pattern before each check. */
+
+static int reset(int fd)
+{
+	return syscall_object_pwrite(fd, pattern, TEST_SIZE, 0) == TEST_SIZE;
+}
+
+static void test_read_calls(int fd)
+{
+	struct iovec iov[2];
+
+	memset(buffer, 0, TEST_SIZE);
+	int result = syscall_object_pread(fd, buffer, 100, 5000);
+	check("pread", result == 100 && same(buffer, &pattern[5000], 100));
+
+	memset(buffer, 0, TEST_SIZE);
+	iov[0].base = buffer;
+	iov[0].length = 10;
+	iov[1].base = &buffer[10];
+	iov[1].length = PAGE_SIZE;
+	syscall_object_seek(fd, 0, KERNEL_SEEK_SET);
+	result = syscall_object_readv(fd, iov, 2);
+	check("readv", result == 10 + PAGE_SIZE && same(buffer, pattern, 10 + PAGE_SIZE));
+
+	check("fsync", syscall_object_fsync(fd) >= 0);
+}
+
+static void test_transfer(int fd, int fd2)
+{
+	syscall_object_seek(fd, 0, KERNEL_SEEK_SET);
+	syscall_object_seek(fd2, 0, KERNEL_SEEK_SET);
+	int result = syscall_object_transfer(fd, fd2, TEST_SIZE);
+
+	memset(buffer, 0, TEST_SIZE);
+	syscall_object_pread(fd2, buffer, TEST_SIZE, 0);
+	check("transfer", result == TEST_SIZE && same(buffer, pattern, TEST_SIZE));
+}
+
+static void test_io_ring(int fd)
+{
+	static char data[64];
+	uint32_t i;
+
+	memset(&ring, 0, sizeof(ring));
+	memset(buffer, 0, TEST_SIZE);
+	memset(data, 'r', sizeof(data));
+
+	struct io_request *r = &ring.sq[0];
+	r->opcode = IO_OP_WRITE;
+	r->fd = fd;
+	r->data = data;
+	r->length = sizeof(data);
+	r->offset = 200;
+	r->user_data = 1;
+
+	r = &ring.sq[1];
+	r->opcode = IO_OP_READ;
+	r->fd = fd;
+	r->data = buffer;
+	r->length = 300;
+	r->offset = 0;
+	r->user_data = 2;
+
+	r = &ring.sq[2];
+	r->opcode = IO_OP_FSYNC;
+	r->fd = fd;
+	r->user_data = 3;
+
+	ring.sq_tail = 3;
+
+	int result = syscall_io_ring_enter(&ring, 3, 3);
+	int ok = result == 3 && ring.cq_tail - ring.cq_head == 3;
+
+	for(i = ring.cq_head; i != ring.cq_tail; i++) {
+		struct io_completion *c = &ring.cq[i % IO_RING_SIZE];
+		if(c->user_data == 1)
+			ok = ok && c->result == sizeof(data);
+		else if(c->user_data == 2)
+			ok = ok && c->result == 300;
+		else
+			ok = ok && c->result >= 0;
+	}
+	ring.cq_head = ring.cq_tail;
+
+	// The read was posted after the write, so it must see the new bytes.
+	ok = ok && same(buffer, pattern, 200) && same(&buffer[200], data, sizeof(data));
+	check("io_ring", ok);
+}
+
+static void test_mmap_private(int fd)
+{
+	char *addr;
+
+	int result = syscall_object_mmap(fd, 0, TEST_SIZE, KERNEL_MMAP_PRIVATE, (void **) &addr);
+	if(result < 0) {
+		printf("mmap: %s\n", strerror(result));
+		check("mmap private", 0);
+		return;
+	}
+
+	check("mmap private", same(addr, pattern, TEST_SIZE));
+	check("munmap", syscall_process_munmap(addr) == 0);
+}
+
+static void test_mmap_shared(int fd)
+{
+	char *addr;
+
+	int result = syscall_object_mmap(fd, 0, TEST_SIZE, KERNEL_MMAP_SHARED, (void **) &addr);
+	if(result < 0) {
+		printf("mmap: %s\n", strerror(result));
+		check("mmap shared", 0);
+		return;
+	}
+
+	// A store through the mapping is seen by an ordinary read.
+	addr[100] = 'm';
+	syscall_object_pread(fd, buffer, 1, 100);
+	check("mmap store, then pread", buffer[0] == 'm');
+
+	// An ordinary write is seen through a page that is already mapped.
+	char c = addr[PAGE_SIZE + 50];
+	char w = 'w';
+	syscall_object_pwrite(fd, &w, 1, PAGE_SIZE + 50);
+	check("pwrite, then mmap load", c == pattern[PAGE_SIZE + 50] && addr[PAGE_SIZE + 50] == 'w');
+
+	addr[2 * PAGE_SIZE + 7] = 'u';
+	syscall_process_munmap(addr);
+
+	// The last unmap writes the dirty page back to the file.
+	syscall_object_pread(fd, buffer, 1, 2 * PAGE_SIZE + 7);
+	check("munmap writes back", buffer[0] == 'u');
+}
+
+static void test_mmap_fork(int fd)
+{
+	static int private_value = 1;
+	struct process_info info;
+	char *addr;
+
+	int result = syscall_object_mmap(fd, 0, TEST_SIZE, KERNEL_MMAP_SHARED, (void **) &addr);
+	if(result < 0) {
+		printf("mmap: %s\n", strerror(result));
+		check("mmap across fork", 0);
+		return;
+	}
+
+	// Map the page before the fork, so that the child inherits it.
+	addr[10] = 'p';
+
+	int pid = syscall_process_fork();
+	if(pid == 0) {
+		addr[10] = 'c';
+		addr[PAGE_SIZE + 10] = 'c';
+		private_value = 2;
+		syscall_process_exit(0);
+	} else if(pid < 0) {
+		printf("fork: %s\n", strerror(pid));
+		check("mmap across fork", 0);
+		syscall_process_munmap(addr);
+		return;
+	}
+
+	syscall_process_wait(&info, -1);
+	syscall_process_reap(info.pid);
+
+	check("mmap across fork, page mapped before", addr[10] == 'c');
+	check("mmap across fork, page mapped after", addr[PAGE_SIZE + 10] == 'c');
+	check("fork keeps private data apart", private_value == 1);
+
+	syscall_process_munmap(addr);
+	syscall_object_pread(fd, buffer, 1, 10);
+	check("mmap across fork, write back", buffer[0] == 'c');
+}
+
+static int open_scratch(const char *dir, const char *name)
+{
+	char path[256];
+
+	path[0] = 0;
+	if(dir) {
+		if(strlen(dir) + strlen(name) + 2 > sizeof(path))
+			return KERROR_INVALID_PATH;
+		strcpy(path, dir);
+		strcat(path, "/");
+	}
+	strcat(path, name);
+
+	int fd = syscall_open_file(path, 0, KERNEL_FLAGS_WRITE | KERNEL_FLAGS_CREATE);
+	if(fd < 0)
+		printf("couldn't open %s: %s\n", path, strerror(fd));
+	return fd;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *dir = argc > 1 ? argv[1] : 0;
+	int i;
+
+	for(i = 0; i < TEST_SIZE; i++)
+		pattern[i] = 'a' + i % 23;
+
+	int fd = open_scratch(dir, "fstest.tmp");
+	if(fd < 0)
+		return 1;
+
+	int fd2 = open_scratch(dir, "fstest2.tmp");
+	if(fd2 < 0) {
+		syscall_object_close(fd);
+		return 1;
+	}
+
+	if(!reset(fd)) {
+		printf("couldn't write the scratch file\n");
+		return 1;
+	}
+
+	test_read_calls(fd);
+	test_transfer(fd, fd2);
+	reset(fd);
+	test_io_ring(fd);
+	reset(fd);
+	test_mmap_private(fd);
+	test_mmap_shared(fd);
+	reset(fd);
+	test_mmap_fork(fd);
+
+	syscall_object_close(fd2);
+	syscall_object_close(fd);
+
+	printf("%d passed, %d failed\n", passed, failed);
+	return failed ? 1 : 0;
+}
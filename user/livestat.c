@@ -194,6 +194,8 @@ int extract_statistic(struct stat_args * args) {
       return ((struct bcache_stats *)args->statistics)->write_misses;
     } else if (!strcmp(args->stat_name, "writebacks")) {
       return ((struct bcache_stats *)args->statistics)->writebacks;
+    } else if (!strcmp(args->stat_name, "readaheads")) {
+      return ((struct bcache_stats *)args->statistics)->readaheads;
     }
   }
   else if (args->stat_type == PROCESS_LIVE) {
@@ -354,7 +356,8 @@ void help() {
   printf("    read_misses\n");
   printf("    write_hits\n");
   printf("    write_misses\n");
-  printf("    writebacks\n\n");
+  printf("    writebacks\n");
+  printf("    readaheads\n\n");
 
   printf("\nProcess STAT_NAME options:\n");
   printf("    blocks_read\n");
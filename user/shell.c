@@ -7,13 +7,23 @@
 
 #define MAX_LINE_LENGTH 1024
 
-void print_directory(char *d, int length)
+void print_directory(int fd)
 {
-	while(length > 0) {
-		printf("%s\n", d);
-		int len = strlen(d) + 1;
-		d += len;
-		length -= len;
+	char buffer[1024];
+	uint32_t cookie = 0;
+	int length;
+
+	while((length = syscall_object_readdir(fd, (struct dir_entry *) buffer, sizeof(buffer), &cookie)) > 0) {
+		int offset = 0;
+		while(offset < length) {
+			struct dir_entry *e = (struct dir_entry *) &buffer[offset];
+			if(e->type == KOBJECT_DIR) {
+				printf("%s/\n", e->name);
+			} else {
+				printf("%s %d\n", e->name, e->size);
+			}
+			offset += e->length;
+		}
 	}
 }
 
@@ -98,12 +108,10 @@ int do_command(char *line)
 			}
 		}
 	} else if(pch && !strcmp(pch, "list")) {
-		char buffer[1024];
 		int fd = syscall_open_file(".",0,0);
 		if(fd>=0) {
-			int length = syscall_object_list(fd, buffer, 1024);
+			print_directory(fd);
 			syscall_object_close(fd);
-			print_directory(buffer, length);
 		}
 	} else if(pch && !strcmp(pch, "chdir")) {
 		char *path = strtok(0, " ");